@@ -1,9 +1,77 @@
 #include "a1lidarrpi.h"
 #include <math.h>
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define A1LIDAR_CARTESIAN_SSE2
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define A1LIDAR_CARTESIAN_NEON
+#endif
+
+namespace {
+
+// sin over the first quadrant for every angle_z_q14 step, the other quadrants
+// and cos follow from it by symmetry so the table only takes 64kB.
+struct QuarterSine {
+	static const unsigned quarter = 1 << 14;
+	float table[quarter + 1];
+
+	QuarterSine() {
+		for (unsigned i = 0; i <= quarter; ++i) {
+			table[i] = (float)sin(i * M_PI / 2 / quarter);
+		}
+	}
+
+	// without branches: odd quadrants swap sin and cos, the sign of sin
+	// flips in quadrants 2 and 3 and the one of cos in 1 and 2
+	void sinCos(uint16_t angle_z_q14, float &s, float &c) const {
+		const unsigned i = angle_z_q14 & (quarter - 1);
+		const unsigned q = angle_z_q14 >> 14;
+		const float a = table[i];
+		const float b = table[quarter - i];
+		s = (q & 1) ? b : a;
+		c = (q & 1) ? a : b;
+		if (q & 2) s = -s;
+		if ((q + 1) & 2) c = -c;
+	}
+};
+
+const QuarterSine quarterSine;
+
+// angle_z_q14 to phi in rad, see A1LidarData::phi
+const float phiScale = 90.f / 16384.f / (180.0f / M_PI);
+
+}
+
 
 void A1Lidar::stop() {
-	running = false;
+	{
+		// wakes up the dispatcher and an acquisition waiting for it
+		std::lock_guard<std::mutex> lock(dispatchMtx);
+		running = false;
+	}
+	dispatchCond.notify_all();
+	if (nullptr != dispatcher) {
+		dispatcher->join();
+		delete dispatcher;
+		dispatcher = nullptr;
+	}
+	if (nullptr != gridWorker) {
+		gridWorker->join();
+		delete gridWorker;
+		gridWorker = nullptr;
+	}
+	if (nullptr != sectorWorker) {
+		sectorWorker->join();
+		delete sectorWorker;
+		sectorWorker = nullptr;
+	}
+	if (nullptr != motorWorker) {
+		motorWorker->join();
+		delete motorWorker;
+		motorWorker = nullptr;
+	}
 	if (nullptr != worker) {
 		worker->join();
 		delete worker;
@@ -73,9 +141,58 @@ void A1Lidar::start(const char *serial_port,
 	}
 
 	// start scan...
+	// the scan buffers hold a revolution down to half the desired speed
+	drv->setScanBufferMinRPM(desiredRPM / 2);
+	if (nullptr != gridInterface) {
+		// zero bins would switch the driver's grid off and leave the grid thread spinning
+		if ( (0 == gridBins) || IS_FAIL(drv->setScanGrid(gridBins, gridPolicy)) ) {
+			throw "Invalid number of grid bins or grid policy.";
+		}
+		gridDist.resize(gridBins);
+		gridQuality.resize(gridBins);
+		gridR.resize(gridBins);
+		gridStrength.resize(gridBins);
+	}
 	drv->startScan(0,true,0,&scanMode);
 
+	const size_t maxNodes = drv->getMaxScanNodes();
+	scanArena.reset(2 * RplidarScanArena::bytesFor(maxNodes));
+	scanArena.carve(sortedScan, maxNodes);
+	scanArena.carve(intervalScan, maxNodes);
+	sectorData.resize(maxNodes);
+	scanCartesian.resize(maxNodes);
+	sectorCartesian.resize(maxNodes);
+	// the A1LidarData arrays are only kept for a DataInterface,
+	// otherwise the first getCurrentData() asks for them
+	if (nullptr != dataInterface) allocDataBuffers();
+	// one slot does without subscribers, more are added while views are held
+	if (scanSlots.empty()) scanSlots.emplace_back(new ScanSlot);
+	for (auto &slot : scanSlots) {
+		if (0 == slot->refs.load(std::memory_order_acquire)) slot->scan.resize(maxNodes);
+	}
+	if (dispatchDepth > 0) {
+		// one more slot than queued scans for the one being dispatched
+		dispatchArena.reset((dispatchDepth + 1) * RplidarScanArena::bytesFor(maxNodes));
+		dispatchSlots.resize(dispatchDepth + 1);
+		dispatchQueue.clear();
+		dispatchFree.clear();
+		for (unsigned slot = 0; slot <= dispatchDepth; ++slot) {
+			dispatchArena.carve(dispatchSlots[slot].scan, maxNodes);
+			dispatchFree.push_back(slot);
+		}
+		dispatcher = new std::thread(A1Lidar::runDispatcher,this);
+	}
+
+	motorIntegral = 0;
+	previousRotationUs = 0;
 	worker = new std::thread(A1Lidar::run,this);
+	motorWorker = new std::thread(A1Lidar::runMotor,this);
+	if (nullptr != sectorInterface) {
+		sectorWorker = new std::thread(A1Lidar::runSectors,this);
+	}
+	if (nullptr != gridInterface) {
+		gridWorker = new std::thread(A1Lidar::runGrid,this);
+	}
 }
 
 void A1Lidar::updateMotorPWM(int _motorDrive) {
@@ -84,45 +201,434 @@ void A1Lidar::updateMotorPWM(int _motorDrive) {
 	gpioPWM(GPIO_PWM,motorDrive);
 }
 
+void A1Lidar::controlMotor() {
+	float rpm;
+	_u64 timestamp_us;
+	// keeps the drive while there's no new estimate, the motor might just be spinning up
+	if (IS_FAIL(drv->getRotationSpeed(rpm, timestamp_us))) return;
+	if (timestamp_us == previousRotationUs) return;
+	const float dt = (previousRotationUs > 0) ?
+		std::min((timestamp_us - previousRotationUs) / 1E6f, 0.1f) : 0;
+	const float dRPM = (dt > 0) ? (rpm - previousRPM) / dt : 0;
+	previousRotationUs = timestamp_us;
+	previousRPM = rpm;
+	currentRPM.store(rpm, std::memory_order_relaxed);
+
+	const float error = desiredRPM - rpm;
+	const float startDrive = 1 / 3.5f;
+	const float maxDrive = (float)maxPWM / (float)pwmRange;
+	const float drive = startDrive + motorKp * error + motorIntegral - motorKd * dRPM;
+	// anti-windup: no integration while the drive is saturated in the direction of the error
+	if ( !( (drive >= maxDrive) && (error > 0) ) &&
+	     !( (drive <= 0) && (error < 0) ) ) {
+		motorIntegral += motorKi * error * dt;
+	}
+	const float pwm = (startDrive + motorKp * error + motorIntegral - motorKd * dRPM) * (float)pwmRange;
+	updateMotorPWM(std::max((int)round(pwm), 0));
+}
+
+void A1Lidar::runMotor(A1Lidar* a1Lidar) {
+	const std::chrono::microseconds period(1000000 / pwm_frequency);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	while (a1Lidar->running) {
+		a1Lidar->controlMotor();
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+	a1Lidar->updateMotorPWM(0);
+	gpioPWM(GPIO_PWM,0);
+	gpioSetMode(GPIO_PWM,PI_INPUT);
+}
+
+void A1Lidar::Cartesian::resize(size_t n) {
+	x.resize(n);
+	y.resize(n);
+	r.resize(n);
+	phi.resize(n);
+}
+
+// phi = pi - angle, so x = -cos(angle) * r and y = sin(angle) * r
+void A1Lidar::toCartesian(const RplidarScanSoA &scan, Cartesian &cart) {
+	const size_t count = scan.count;
+	// there are no gathers, so the table is read one reading at a time
+	// and the directions are scaled by the distances in a second pass
+	for (size_t pos = 0; pos < count; ++pos) {
+		float s, c;
+		quarterSine.sinCos(scan.angle_z_q14[pos], s, c);
+		cart.x[pos] = -c;
+		cart.y[pos] = s;
+	}
+	size_t pos = 0;
+#if defined(A1LIDAR_CARTESIAN_SSE2)
+	for (; pos + 4 <= count; pos += 4) {
+		const __m128i dist_q2 = _mm_loadu_si128((const __m128i *)(scan.dist_mm_q2 + pos));
+		const __m128 dist = _mm_mul_ps(_mm_cvtepi32_ps(dist_q2), _mm_set1_ps(1 / 4000.0f));
+		const __m128i angle_q14 = _mm_unpacklo_epi16(
+			_mm_loadl_epi64((const __m128i *)(scan.angle_z_q14 + pos)), _mm_setzero_si128());
+		const __m128 phi = _mm_sub_ps(_mm_set1_ps((float)M_PI),
+					      _mm_mul_ps(_mm_cvtepi32_ps(angle_q14), _mm_set1_ps(phiScale)));
+		_mm_storeu_ps(&cart.r[pos], dist);
+		_mm_storeu_ps(&cart.phi[pos], phi);
+		_mm_storeu_ps(&cart.x[pos], _mm_mul_ps(_mm_loadu_ps(&cart.x[pos]), dist));
+		_mm_storeu_ps(&cart.y[pos], _mm_mul_ps(_mm_loadu_ps(&cart.y[pos]), dist));
+	}
+#elif defined(A1LIDAR_CARTESIAN_NEON)
+	for (; pos + 4 <= count; pos += 4) {
+		const float32x4_t dist = vmulq_n_f32(vcvtq_f32_u32(vld1q_u32(scan.dist_mm_q2 + pos)), 1 / 4000.0f);
+		const float32x4_t angle = vcvtq_f32_u32(vmovl_u16(vld1_u16(scan.angle_z_q14 + pos)));
+		const float32x4_t phi = vsubq_f32(vdupq_n_f32((float)M_PI), vmulq_n_f32(angle, phiScale));
+		vst1q_f32(&cart.r[pos], dist);
+		vst1q_f32(&cart.phi[pos], phi);
+		vst1q_f32(&cart.x[pos], vmulq_f32(vld1q_f32(&cart.x[pos]), dist));
+		vst1q_f32(&cart.y[pos], vmulq_f32(vld1q_f32(&cart.y[pos]), dist));
+	}
+#endif
+	for (; pos < count; ++pos) {
+		const float dist = scan.dist_mm_q2[pos] * (1 / 4000.0f);
+		cart.r[pos] = dist;
+		cart.phi[pos] = (float)M_PI - scan.angle_z_q14[pos] * phiScale;
+		cart.x[pos] *= dist;
+		cart.y[pos] *= dist;
+	}
+}
+
+void A1Lidar::convert(const RplidarScanSoA &scan, const Cartesian &cart, size_t pos, A1LidarData &data) {
+	data.phi = cart.phi[pos];
+	data.valid = scan.dist_mm_q2[pos] > 0;
+	if (data.valid) {
+		data.r = cart.r[pos];
+		data.x = cart.x[pos];
+		data.y = cart.y[pos];
+		data.signal_strength =
+			scan.quality[pos] >> RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT;
+	}
+}
+
+void A1LidarScan::resize(unsigned n) {
+	// rounded up to 4 floats, so every array starts 16 byte aligned
+	const size_t n4 = (n + 3) & ~(size_t)3;
+	const size_t words = (n + 31) / 32;
+	const size_t bytes = n4 * (sizeof(uint64_t) + 5 * sizeof(float)) + words * sizeof(uint32_t);
+	storage.reset(new unsigned char[bytes + 15]);
+	unsigned char *base = storage.get() + (16 - (uintptr_t)storage.get() % 16) % 16;
+	timestamp_us = reinterpret_cast<uint64_t*>(base);
+	base += n4 * sizeof(uint64_t);
+	x = reinterpret_cast<float*>(base);
+	y = x + n4;
+	r = y + n4;
+	phi = r + n4;
+	signal_strength = phi + n4;
+	validBits = reinterpret_cast<uint32_t*>(signal_strength + n4);
+	memset(validBits, 0, words * sizeof(uint32_t));
+	capacity = n;
+	count = 0;
+	nReadings = 0;
+}
+
+void A1Lidar::append(const A1LidarData &data, uint64_t timestamp_us, unsigned pos, A1LidarScan &scan) {
+	scan.validBits[pos / 32] |= 1u << (pos % 32);
+	const unsigned n = scan.count++;
+	scan.x[n] = data.x;
+	scan.y[n] = data.y;
+	scan.r[n] = data.r;
+	scan.phi[n] = data.phi;
+	scan.signal_strength[n] = data.signal_strength;
+	scan.timestamp_us[n] = timestamp_us;
+}
+
+A1Lidar::DataBuffers A1Lidar::allocDataBuffers() {
+	DataBuffers buffers = a1LidarData.load(std::memory_order_acquire);
+	if (nullptr != buffers) return buffers;
+	// the reader and the acquisition may both get here first
+	DataBuffers allocated = new A1LidarData[3][nDistance];
+	if (a1LidarData.compare_exchange_strong(buffers, allocated, std::memory_order_acq_rel)) {
+		return allocated;
+	}
+	delete[] allocated;
+	return buffers;
+}
+
+const A1LidarData (&A1Lidar::getCurrentData(uint64_t &seq))[nDistance] {
+	DataBuffers buffers = allocDataBuffers();
+	if (spareBufIdx.load(std::memory_order_relaxed) & FRESH) {
+		readBufIdx = spareBufIdx.exchange(readBufIdx, std::memory_order_acq_rel) & ~FRESH;
+	}
+	seq = bufferSeq[readBufIdx];
+	return buffers[readBufIdx];
+}
+
 void A1Lidar::getData() {
-	size_t count = (size_t)nDistance;
-	rplidar_response_measurement_node_hq_t nodes[count];
-	u_result op_result = drv->grabScanDataHq(nodes, count);
+	RplidarScanLease lease;
+	u_result op_result = drv->grabScanLease(lease);
 	if (IS_OK(op_result)) {
-		unsigned long timeNow = getTimeMS();
-		if (previousTime > 0) {
-			float t = (timeNow - previousTime) / 1000.0f;
-			currentRPM = 1.0f/t * 60.0f;
+		if (nullptr != dispatcher) {
+			queueScan(*lease);
+		} else {
+			processScan(*lease, getRPM());
+		}
+	}
+}
+
+void A1Lidar::processScan(const RplidarScanSoA &scan, float rpm) {
+	// a scan without any valid point can't be sorted, it's all invalid anyway
+	const RplidarScanSoA &sorted =
+		IS_OK(drv->ascendScanData(scan, sortedScan)) ? sortedScan : scan;
+	const size_t count = sorted.count;
+	toCartesian(sorted, scanCartesian);
+	unsigned held;
+	ScanSlot *slot = freeScanSlot(held);
+	A1LidarScan &a1LidarScan = slot->scan;
+	a1LidarScan.count = 0;
+	a1LidarScan.nReadings = count;
+	memset(a1LidarScan.validBits, 0, (count + 31) / 32 * sizeof(uint32_t));
+	// without a reader of the A1LidarData arrays the readings only pass through
+	DataBuffers buffers = (nullptr != dataInterface) ?
+		allocDataBuffers() : a1LidarData.load(std::memory_order_acquire);
+	A1LidarData reading;
+	for (int pos = 0; pos < (int)count ; ++pos) {
+		A1LidarData &data = (nullptr != buffers) ? buffers[fillBufIdx][pos] : reading;
+		convert(sorted, scanCartesian, pos, data);
+		if (data.valid) {
+			dataAvailable = true;
+			append(data, sorted.timestamp_us[pos], pos, a1LidarScan);
+		}
+	}
+	if (nullptr != buffers) {
+		// readings left over from a longer scan in this buffer
+		for (unsigned pos = count; pos < bufferCount[fillBufIdx]; ++pos) {
+			buffers[fillBufIdx][pos].valid = false;
+		}
+		bufferCount[fillBufIdx] = count;
+	}
+	if ( (dataAvailable) && (nullptr != dataInterface) ) {
+		dataInterface->newScanAvail(rpm, buffers[fillBufIdx]);
+	}
+	if ( (dataAvailable) && (nullptr != scanInterface) ) {
+		scanInterface->newScanAvail(rpm, a1LidarScan);
+	}
+	++scanSeq;
+	// skipped for subscribers while they hold as many scans as they may
+	if ( (dataAvailable) && (held < maxHeldScans) ) {
+		std::lock_guard<std::mutex> lock(subscriptionMtx);
+		for (Subscription &sub : subscriptions) {
+			if (++sub.skipped < sub.decimation) continue;
+			sub.skipped = 0;
+			slot->refs.fetch_add(1, std::memory_order_relaxed);
+			sub.si->newScanAvail(A1LidarScanView(a1LidarScan, &slot->refs, sub.fields, rpm, scanSeq));
+		}
+	}
+	if (nullptr != buffers) {
+		bufferSeq[fillBufIdx] = scanSeq;
+		fillBufIdx = spareBufIdx.exchange(fillBufIdx | FRESH, std::memory_order_acq_rel) & ~FRESH;
+	}
+}
+
+A1Lidar::ScanSlot *A1Lidar::freeScanSlot(unsigned &held) {
+	// views are only released meanwhile, so held never undercounts
+	held = 0;
+	ScanSlot *free = nullptr;
+	for (auto &slot : scanSlots) {
+		// pairs with the release of the last view
+		if (0 != slot->refs.load(std::memory_order_acquire)) {
+			held++;
+		} else if (nullptr == free) {
+			free = slot.get();
+		}
+	}
+	if (nullptr == free) {
+		// at most maxHeldScans + 1 slots as the subscribers never hold more
+		scanSlots.emplace_back(new ScanSlot);
+		free = scanSlots.back().get();
+	}
+	// new, or sized for the scan mode of an earlier start()
+	if (free->scan.capacity < sortedScan.capacity) free->scan.resize(sortedScan.capacity);
+	return free;
+}
+
+void A1Lidar::subscribe(SubscriberInterface* si, unsigned decimation, unsigned fields) {
+	std::lock_guard<std::mutex> lock(subscriptionMtx);
+	Subscription sub;
+	sub.si = si;
+	sub.decimation = decimation > 0 ? decimation : 1;
+	sub.fields = fields;
+	// the first scan goes out right away
+	sub.skipped = sub.decimation - 1;
+	subscriptions.push_back(sub);
+}
+
+void A1Lidar::unsubscribe(SubscriberInterface* si) {
+	std::lock_guard<std::mutex> lock(subscriptionMtx);
+	for (auto it = subscriptions.begin(); it != subscriptions.end(); ) {
+		if (it->si == si) {
+			it = subscriptions.erase(it);
+		} else {
+			++it;
 		}
-		previousTime = timeNow;
-		drv->ascendScanData(nodes, count);
-		for (int pos = 0; pos < (int)count ; ++pos) {
-			float angle = M_PI - nodes[pos].angle_z_q14 * (90.f / 16384.f / (180.0f / M_PI));
-			float dist = nodes[pos].dist_mm_q2/4000.0f;
-			if (dist > 0) {
-				//fprintf(stderr,"%d,phi=%f,r=%f\n",j,angle,dist);
-				a1LidarData[currentBufIdx][pos].phi = angle;
-				a1LidarData[currentBufIdx][pos].r = dist;
-				a1LidarData[currentBufIdx][pos].x = cos(angle) * dist;
-				a1LidarData[currentBufIdx][pos].y = sin(angle) * dist;
-				a1LidarData[currentBufIdx][pos].signal_strength =
-					nodes[pos].quality >> RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT;
-				a1LidarData[currentBufIdx][pos].valid = true;
-				dataAvailable = true;
-			} else {
-				a1LidarData[currentBufIdx][pos].valid = false;
+	}
+}
+
+A1LidarScanView::A1LidarScanView(const A1LidarScan &scan, std::atomic<int> *refs,
+				 unsigned fields, float rpm, uint64_t seq) :
+	rpm(rpm), seq(seq), count(scan.count), nReadings(scan.nReadings), refs(refs) {
+	if (fields & X) x = scan.x;
+	if (fields & Y) y = scan.y;
+	if (fields & R) r = scan.r;
+	if (fields & PHI) phi = scan.phi;
+	if (fields & SIGNAL_STRENGTH) signal_strength = scan.signal_strength;
+	if (fields & TIMESTAMP) timestamp_us = scan.timestamp_us;
+	if (fields & VALID_BITS) validBits = scan.validBits;
+}
+
+void A1Lidar::copyScan(const RplidarScanSoA &from, RplidarScanSoA &to) {
+	const size_t count = from.count < to.capacity ? from.count : to.capacity;
+	memcpy(to.angle_z_q14, from.angle_z_q14, count * sizeof(*to.angle_z_q14));
+	memcpy(to.dist_mm_q2, from.dist_mm_q2, count * sizeof(*to.dist_mm_q2));
+	memcpy(to.quality, from.quality, count);
+	memcpy(to.flag, from.flag, count);
+	memcpy(to.timestamp_us, from.timestamp_us, count * sizeof(*to.timestamp_us));
+	to.count = count;
+	to.seq = from.seq;
+}
+
+void A1Lidar::queueScan(const RplidarScanSoA &scan) {
+	unsigned slot;
+	{
+		std::unique_lock<std::mutex> lock(dispatchMtx);
+		dispatchStats.queued++;
+		if (dispatchQueue.size() == dispatchDepth) {
+			switch (dispatchPolicy) {
+			case DISPATCH_DROP_NEWEST:
+				dispatchStats.droppedNewest++;
+				return;
+			case DISPATCH_BLOCK: {
+				dispatchStats.blocked++;
+				const auto t0 = std::chrono::steady_clock::now();
+				dispatchCond.wait(lock, [this] {
+						return (dispatchQueue.size() < dispatchDepth) || !running;
+					});
+				dispatchStats.blockedUs += std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - t0).count();
+				if (!running) return;
+				break;
+			}
+			default:
+				dispatchStats.droppedOldest++;
+				dispatchFree.push_back(dispatchQueue.front());
+				dispatchQueue.pop_front();
+				break;
 			}
 		}
-		updateMotorPWM(
-			       motorDrive +
-			       (int)round((desiredRPM - currentRPM) * loopRPMgain * (float)pwmRange)
-			       );
-		if ( (dataAvailable) && (nullptr != dataInterface) ) {
-			dataInterface->newScanAvail(currentRPM, a1LidarData[currentBufIdx]);
+		// the queue and the dispatcher never hold more than all slots but one
+		slot = dispatchFree.back();
+		dispatchFree.pop_back();
+	}
+	copyScan(scan, dispatchSlots[slot].scan);
+	dispatchSlots[slot].rpm = getRPM();
+	{
+		std::lock_guard<std::mutex> lock(dispatchMtx);
+		dispatchQueue.push_back(slot);
+	}
+	dispatchCond.notify_all();
+}
+
+void A1Lidar::dispatch() {
+	unsigned slot;
+	{
+		std::unique_lock<std::mutex> lock(dispatchMtx);
+		dispatchCond.wait(lock, [this] {
+				return !dispatchQueue.empty() || !running;
+			});
+		if (dispatchQueue.empty()) return;
+		slot = dispatchQueue.front();
+		dispatchQueue.pop_front();
+	}
+	// the acquisition may be waiting for room
+	dispatchCond.notify_all();
+	processScan(dispatchSlots[slot].scan, dispatchSlots[slot].rpm);
+	{
+		std::lock_guard<std::mutex> lock(dispatchMtx);
+		dispatchStats.dispatched++;
+		dispatchFree.push_back(slot);
+	}
+}
+
+void A1Lidar::runDispatcher(A1Lidar* a1Lidar) {
+	while (a1Lidar->running) {
+		a1Lidar->dispatch();
+	}
+}
+
+A1Lidar::DispatchStats A1Lidar::getDispatchStats() {
+	std::lock_guard<std::mutex> lock(dispatchMtx);
+	return dispatchStats;
+}
+
+void A1Lidar::sendSector() {
+	A1LidarSector sector;
+	sector.startPhi = sectorData[0].phi;
+	sector.endPhi = sectorData[sectorCount - 1].phi;
+	sector.startTimestamp_us = sectorStartUs;
+	sector.endTimestamp_us = sectorEndUs;
+	sector.count = sectorCount;
+	sector.data = sectorData.data();
+	sectorInterface->newSectorAvail(sector);
+	sectorCount = 0;
+}
+
+void A1Lidar::getSectorData() {
+	// returns after every decoded capsule, the timeout only lets stop() get through
+	u_result op_result = drv->getScanDataWithIntervalHq(intervalScan, 100);
+	if (IS_FAIL(op_result)) return;
+	const size_t count = intervalScan.count;
+	toCartesian(intervalScan, sectorCartesian);
+	for (size_t pos = 0; pos < count; ++pos) {
+		// a sector is complete once the first reading of the next one comes in
+		unsigned sector = ((unsigned)intervalScan.angle_z_q14[pos] * nSectors) >> 16;
+		bool newScan = intervalScan.flag[pos] & RPLIDAR_RESP_MEASUREMENT_SYNCBIT;
+		if ( (sectorCount > 0) &&
+		     ( (sector != currentSector) || newScan || (sectorCount == sectorData.size()) ) ) {
+			sendSector();
 		}
-		readoutMtx.lock();
-		currentBufIdx = !currentBufIdx;
-		readoutMtx.unlock();
+		currentSector = sector;
+		if (0 == sectorCount) sectorStartUs = intervalScan.timestamp_us[pos];
+		sectorEndUs = intervalScan.timestamp_us[pos];
+		convert(intervalScan, sectorCartesian, pos, sectorData[sectorCount++]);
+	}
+	if ( (0 == nSectors) && (sectorCount > 0) ) {
+		sendSector();
+	}
+}
+
+void A1Lidar::runSectors(A1Lidar* a1Lidar) {
+	while (a1Lidar->running) {
+		a1Lidar->getSectorData();
+	}
+}
+
+void A1Lidar::getGridData() {
+	RplidarScanGrid grid;
+	grid.dist_mm_q2 = gridDist.data();
+	grid.quality = gridQuality.data();
+	grid.bins = gridDist.size();
+	// the timeout only lets stop() get through
+	u_result op_result = drv->grabScanGrid(grid, 100);
+	if (IS_FAIL(op_result)) return;
+	for (size_t i = 0; i < grid.bins; ++i) {
+		gridR[i] = grid.dist_mm_q2[i] / 4000.0f;
+		gridStrength[i] = grid.quality[i] >> RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT;
+	}
+	A1LidarGrid a1LidarGrid;
+	a1LidarGrid.nBins = grid.bins;
+	a1LidarGrid.r = gridR.data();
+	a1LidarGrid.signal_strength = gridStrength.data();
+	a1LidarGrid.startTimestamp_us = grid.start_us;
+	a1LidarGrid.endTimestamp_us = grid.end_us;
+	gridInterface->newGridAvail(getRPM(), a1LidarGrid);
+}
+
+void A1Lidar::runGrid(A1Lidar* a1Lidar) {
+	while (a1Lidar->running) {
+		a1Lidar->getGridData();
 	}
 }
 
@@ -130,7 +636,4 @@ void A1Lidar::run(A1Lidar* a1Lidar) {
 	while (a1Lidar->running) {
 		a1Lidar->getData();
 	}
-	a1Lidar->updateMotorPWM(0);
-	gpioPWM(GPIO_PWM,0);
-	gpioSetMode(GPIO_PWM,PI_INPUT);
 }
@@ -7,19 +7,28 @@
 
 #include <iostream>
 #include <cstring>
+#include <math.h>
 #include <unistd.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <pigpio.h>
 #include <thread>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <algorithm>
 
 #include "rplidarsdk/rplidar.h"
 
 using namespace rp::standalone::rplidar;
 
 /**
- * One of the 8192 distance datapoints
+ * One of the 8192 distance datapoints. The time each reading
+ * was taken at is in A1LidarScan and A1LidarScanView.
  **/
 class A1LidarData {
 public:
@@ -57,6 +66,231 @@ public:
 };
 
 
+/**
+ * One 360 degree scan in structure-of-arrays form which holds only the
+ * valid readings, packed in ascending angle order. Element i of every
+ * array belongs to the same reading, so the arrays can be processed
+ * with plain (or SIMD) loads. Every array starts 16 byte aligned and
+ * has room for as many readings as a scan of the current scan mode.
+ **/
+class A1LidarScan {
+public:
+	/**
+	 * Number of valid readings in the arrays below
+	 **/
+	unsigned count = 0;
+
+	/**
+	 * Same meaning as in A1LidarData
+	 **/
+	float* x = nullptr;
+	float* y = nullptr;
+	float* r = nullptr;
+	float* phi = nullptr;
+	float* signal_strength = nullptr;
+
+	/**
+	 * Time the reading was taken at in microseconds,
+	 * on the CLOCK_MONOTONIC clock.
+	 **/
+	uint64_t* timestamp_us = nullptr;
+
+	/**
+	 * Number of readings of the scan including the invalid ones,
+	 * in the same order as the A1LidarData array
+	 **/
+	unsigned nReadings = 0;
+
+	/**
+	 * Bit i is set when reading i of the A1LidarData array is valid
+	 **/
+	uint32_t* validBits = nullptr;
+
+	bool isValid(unsigned i) const {
+		return (validBits[i / 32] >> (i % 32)) & 1;
+	}
+
+	/**
+	 * Number of readings the arrays have room for
+	 **/
+	unsigned capacity = 0;
+
+	A1LidarScan() {}
+
+	/**
+	 * Makes room for n readings, the readings held are lost
+	 **/
+	void resize(unsigned n);
+
+private:
+	// the arrays point into storage, a copy would point into the original
+	A1LidarScan(const A1LidarScan &);
+	A1LidarScan & operator=(const A1LidarScan &);
+
+	std::unique_ptr<unsigned char[]> storage;
+};
+
+
+/**
+ * Read only, reference counted view of an A1LidarScan shared by all
+ * subscribers, see A1Lidar::subscribe(). Copies share the scan which
+ * isn't reused before the last of them is released or destroyed.
+ * The arrays of fields the subscriber hasn't asked for are nullptr.
+ * All views have to be released before the A1Lidar is destroyed.
+ **/
+class A1LidarScanView {
+public:
+	/**
+	 * Fields to subscribe to, or-ed together
+	 **/
+	enum Field {
+		X = 1,
+		Y = 2,
+		R = 4,
+		PHI = 8,
+		SIGNAL_STRENGTH = 16,
+		TIMESTAMP = 32,
+		VALID_BITS = 64,
+		ALL = 127
+	};
+
+	/**
+	 * RPM when the scan came in and its number, see A1Lidar::getCurrentData()
+	 **/
+	float rpm = 0;
+	uint64_t seq = 0;
+
+	/**
+	 * Same meaning as in A1LidarScan
+	 **/
+	unsigned count = 0;
+	const float* x = nullptr;
+	const float* y = nullptr;
+	const float* r = nullptr;
+	const float* phi = nullptr;
+	const float* signal_strength = nullptr;
+	const uint64_t* timestamp_us = nullptr;
+	unsigned nReadings = 0;
+	const uint32_t* validBits = nullptr;
+
+	A1LidarScanView() {}
+
+	/**
+	 * Adopts one reference already counted in refs
+	 **/
+	A1LidarScanView(const A1LidarScan &scan, std::atomic<int> *refs,
+			unsigned fields, float rpm, uint64_t seq);
+
+	A1LidarScanView(const A1LidarScanView &other) {
+		*this = other;
+	}
+
+	A1LidarScanView &operator=(const A1LidarScanView &other) {
+		if (other.refs) other.refs->fetch_add(1, std::memory_order_relaxed);
+		release();
+		rpm = other.rpm;
+		seq = other.seq;
+		count = other.count;
+		x = other.x;
+		y = other.y;
+		r = other.r;
+		phi = other.phi;
+		signal_strength = other.signal_strength;
+		timestamp_us = other.timestamp_us;
+		nReadings = other.nReadings;
+		validBits = other.validBits;
+		refs = other.refs;
+		return *this;
+	}
+
+	~A1LidarScanView() {
+		release();
+	}
+
+	void release() {
+		// the scan may be refilled as soon as the count drops to 0
+		if (refs) refs->fetch_sub(1, std::memory_order_release);
+		refs = nullptr;
+	}
+
+	bool valid() const { return nullptr != refs; }
+
+private:
+	std::atomic<int> *refs = nullptr;
+};
+
+
+/**
+ * Readings of one angular sector which are delivered
+ * as soon as they have been decoded
+ **/
+class A1LidarSector {
+public:
+	/**
+	 * Angle in rad of the first and the last reading
+	 * with the same orientation as A1LidarData::phi
+	 **/
+	float startPhi;
+	float endPhi;
+
+	/**
+	 * Timestamps in us (CLOCK_MONOTONIC) of the first and
+	 * the last reading
+	 **/
+	uint64_t startTimestamp_us;
+	uint64_t endTimestamp_us;
+
+	/**
+	 * Number of readings
+	 **/
+	unsigned count;
+
+	/**
+	 * The readings in the order they were taken. Only valid
+	 * during the callback.
+	 **/
+	const A1LidarData* data;
+};
+
+
+/**
+ * One revolution resampled onto evenly spaced angles, similar to
+ * the ranges of a ROS LaserScan. Bin i is centred at phi(i).
+ **/
+class A1LidarGrid {
+public:
+	/**
+	 * Number of bins in one revolution
+	 **/
+	unsigned nBins;
+
+	/**
+	 * Distance in m per bin, 0 when the bin has no valid reading
+	 **/
+	const float* r;
+
+	/**
+	 * Signal strength per bin as a value between 0 and 1
+	 **/
+	const float* signal_strength;
+
+	/**
+	 * Timestamps in us (CLOCK_MONOTONIC) of the first and
+	 * the last reading of the revolution
+	 **/
+	uint64_t startTimestamp_us;
+	uint64_t endTimestamp_us;
+
+	/**
+	 * Angle in rad of the centre of bin i with the same
+	 * orientation as A1LidarData::phi
+	 **/
+	float phi(unsigned i) const {
+		return (float)(M_PI - (i + 0.5) * 2 * M_PI / nBins);
+	}
+};
+
+
 /**
  * Class to continously acquire data from the LIDAR
  **/
@@ -93,6 +327,7 @@ public:
 	 **/
 	~A1Lidar() {
 		stop();
+		delete[] a1LidarData.load();
 	}
 
 	/**
@@ -110,55 +345,298 @@ public:
 	}
 
 	/**
-	 * Returns the current databuffer which is not being written to.
+	 * What the acquisition does with a new scan when the
+	 * dispatcher still has queueDepth scans to pass on
+	 **/
+	enum DispatchPolicy {
+		DISPATCH_DROP_OLDEST, // replaces the oldest scan waiting
+		DISPATCH_DROP_NEWEST, // throws the new scan away
+		DISPATCH_BLOCK        // waits for the dispatcher
+	};
+
+	/**
+	 * Call the DataInterface and the ScanInterface from a
+	 * dispatcher thread of their own before start(), so a slow
+	 * callback doesn't hold up the acquisition and the motor
+	 * control. Up to queueDepth scans wait for the dispatcher.
+	 * With DISPATCH_BLOCK the acquisition waits for a slow
+	 * callback again, but never loses a scan to it.
+	 **/
+	void setDispatcher(unsigned queueDepth = 4,
+			   DispatchPolicy policy = DISPATCH_DROP_OLDEST) {
+		dispatchDepth = queueDepth;
+		dispatchPolicy = policy;
+	}
+
+	/**
+	 * Counters of the dispatcher since the start
+	 **/
+	struct DispatchStats {
+		uint64_t queued = 0;        // scans handed to the dispatcher
+		uint64_t dispatched = 0;    // scans passed on to the callbacks
+		uint64_t droppedOldest = 0; // DISPATCH_DROP_OLDEST: waiting scans replaced
+		uint64_t droppedNewest = 0; // DISPATCH_DROP_NEWEST: new scans thrown away
+		uint64_t blocked = 0;       // DISPATCH_BLOCK: times the acquisition waited
+		uint64_t blockedUs = 0;     // DISPATCH_BLOCK: time it waited in us
+	};
+
+	DispatchStats getDispatchStats();
+
+	/**
+	 * Callback interface for the compacted scan which needs to be implemented by the user.
+	 **/
+	struct ScanInterface {
+		virtual void newScanAvail(float rpm, const A1LidarScan &scan) = 0;
+	};
+
+	/**
+	 * Register the callback interface here to receive every scan
+	 * with only its valid readings, see A1LidarScan. It is called
+	 * right after the DataInterface with the same scan.
+	 **/
+	void registerScanInterface(ScanInterface* si) {
+		scanInterface = si;
+	}
+
+	/**
+	 * Callback interface of a subscriber which needs to be implemented by the user.
+	 * The view can be kept after the callback has returned to be processed in
+	 * another thread, the scan behind it stays untouched while it is held.
+	 **/
+	struct SubscriberInterface {
+		virtual void newScanAvail(const A1LidarScanView &view) = 0;
+	};
+
+	/**
+	 * Adds a subscriber which gets every decimation'th scan with the fields
+	 * (A1LidarScanView::Field) it asks for. All subscribers share one copy
+	 * of the scan. The subscribers are called one after the other after the
+	 * ScanInterface and must not subscribe or unsubscribe from the callback.
+	 * Between them the subscribers may hold views of up to 8 scans, beyond
+	 * that the new scans aren't passed on until they release one.
+	 **/
+	void subscribe(SubscriberInterface* si, unsigned decimation = 1,
+		       unsigned fields = A1LidarScanView::ALL);
+
+	/**
+	 * Removes a subscriber, it isn't called any more once this returns
+	 **/
+	void unsubscribe(SubscriberInterface* si);
+
+	/**
+	 * Callback interface for the sectors which needs to be implemented by the user.
+	 **/
+	struct SectorInterface {
+		virtual void newSectorAvail(const A1LidarSector &sector) = 0;
+	};
+
+	/**
+	 * Register the sector callback interface here to receive the readings
+	 * while the LIDAR turns, before start(). One revolution is divided into
+	 * sectorsPerRevolution sectors (36 gives 10 degrees). With 0 every
+	 * batch of readings is passed on as soon as it has been decoded.
+	 **/
+	void registerSectorInterface(SectorInterface* si, unsigned sectorsPerRevolution = 36) {
+		sectorInterface = si;
+		nSectors = sectorsPerRevolution;
+	}
+
+	/**
+	 * Callback interface for the resampled revolutions which needs to be implemented by the user.
+	 **/
+	struct GridInterface {
+		virtual void newGridAvail(float rpm, const A1LidarGrid &grid) = 0;
+	};
+
+	/**
+	 * Register the grid callback interface here before start() to receive every
+	 * revolution binned into nBins evenly spaced angles, e.g. 360, 720 or 1440.
+	 * The binning happens while the data is decoded so no sorting is needed.
+	 * When several readings fall into one bin the policy decides which distance
+	 * it gets: SCAN_GRID_NEAREST (closest to the centre of the bin),
+	 * SCAN_GRID_MIN_RANGE (closest obstacle) or SCAN_GRID_MEAN. start()
+	 * throws when nBins is 0 or above 8192 or the policy is unknown.
+	 **/
+	void registerGridInterface(GridInterface* gi, unsigned nBins = 360,
+				   unsigned policy = SCAN_GRID_NEAREST) {
+		gridInterface = gi;
+		gridBins = nBins;
+		gridPolicy = policy;
+	}
+
+	/**
+	 * Returns the latest complete scan. Its buffer isn't written to before
+	 * getCurrentData() is called again, so it can be read at leisure while
+	 * the acquisition carries on without ever waiting for the reader.
+	 * Only one thread at a time may read the data this way. seq numbers
+	 * the scans starting at 1, it stays the same until a new scan has
+	 * come in and is 0 before the first one. Without a DataInterface the
+	 * scans are only kept in this form from the first call on.
+	 **/
+	const A1LidarData (&getCurrentData(uint64_t &seq))[nDistance];
+
+	/**
+	 * Same as above without the number of the scan
 	 **/
 	inline A1LidarData (&getCurrentData())[nDistance]  {
-		readoutMtx.lock();
-		return a1LidarData[!currentBufIdx];
-		readoutMtx.unlock();
+		uint64_t seq;
+		getCurrentData(seq);
+		return a1LidarData.load(std::memory_order_relaxed)[readBufIdx];
 	}
 
 	/**
 	 * Returns the current RPM
 	 **/
-	float getRPM() { return (float)currentRPM; }
+	float getRPM() { return currentRPM.load(std::memory_order_relaxed); }
+
+	/**
+	 * Sets the gains of the motor speed controller. The motor
+	 * is driven 50 times a second with the PWM as a fraction
+	 * of the PWM range of 1/3.5 + kp * error + the integral of
+	 * ki * error - kd * the change of the RPM per second where
+	 * error is the desired RPM minus the current RPM.
+	 * Call it before start().
+	 **/
+	void setMotorPID(float kp, float ki, float kd = 0) {
+		motorKp = kp;
+		motorKi = ki;
+		motorKd = kd;
+	}
 
 	/**
 	 * Returns the actual PWM range
 	 **/
 	int getPWMrange() { return pwmRange; }
 
-private:
-	static unsigned long getTimeMS() {
-		std::chrono::time_point<std::chrono::system_clock> now = 
-			std::chrono::system_clock::now();
-		auto duration = now.time_since_epoch();
-		return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-	}
+	/**
+	 * x, y, r and phi of all readings of a scan with the same
+	 * meaning as in A1LidarData, invalid readings included
+	 **/
+	struct Cartesian {
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> r;
+		std::vector<float> phi;
+		void resize(size_t n);
+	};
+
+	/**
+	 * Converts a scan of the driver in one go. cart has to be
+	 * resized to at least scan.count readings beforehand.
+	 **/
+	static void toCartesian(const RplidarScanSoA &scan, Cartesian &cart);
 
-	unsigned long previousTime = 0;
+private:
 	static const int GPIO_PWM = 18;
 	int maxPWM = 1;
 	static const int pwm_frequency = 50;
 	float desiredRPM = 250;
-	const float loopRPMgain = 0.00005f;
+	// the motor control runs at the PWM frequency from the rotation
+	// speed the driver estimates while decoding, see controlMotor()
+	float motorKp = 0.0006f;
+	float motorKi = 0.003f;
+	float motorKd = 0;
+	float motorIntegral = 0;
+	float previousRPM = 0;
+	uint64_t previousRotationUs = 0;
 	static const int nPackets = 90;
 	DataInterface* dataInterface = nullptr;
+	ScanInterface* scanInterface = nullptr;
 	float rpm(unsigned char *packet);
 	void updateMotorPWM(int newMotorDrive);
+	void controlMotor();
+	static void runMotor(A1Lidar* a1Lidar);
 	void getData();
+	void processScan(const RplidarScanSoA &scan, float rpm);
+	static void copyScan(const RplidarScanSoA &from, RplidarScanSoA &to);
+	void queueScan(const RplidarScanSoA &scan);
+	void dispatch();
+	static void runDispatcher(A1Lidar* a1Lidar);
+	void getSectorData();
+	void sendSector();
+	static void convert(const RplidarScanSoA &scan, const Cartesian &cart, size_t pos, A1LidarData &data);
+	static void append(const A1LidarData &data, uint64_t timestamp_us, unsigned pos, A1LidarScan &scan);
 	static void run(A1Lidar* a1Lidar);
+	static void runSectors(A1Lidar* a1Lidar);
+	void getGridData();
+	static void runGrid(A1Lidar* a1Lidar);
 	int tty_fd = 0;
-	bool running = true;
+	std::atomic<bool> running{true};
         int motorDrive = 50;
-	A1LidarData a1LidarData[2][nDistance];
+	// triple buffer: getData() fills a1LidarData[fillBufIdx], getCurrentData()
+	// reads a1LidarData[readBufIdx] and the spare buffer in between changes
+	// hands with an atomic exchange, marked FRESH when it holds a new scan.
+	// The buffers are only allocated for the DataInterface or getCurrentData()
+	static const unsigned FRESH = 4;
+	typedef A1LidarData (*DataBuffers)[nDistance];
+	std::atomic<DataBuffers> a1LidarData{nullptr};
+	DataBuffers allocDataBuffers();
+	uint64_t bufferSeq[3] = {0, 0, 0};
+	unsigned bufferCount[3] = {0, 0, 0};
+	unsigned fillBufIdx = 0;
+	std::atomic<unsigned> spareBufIdx{1};
+	unsigned readBufIdx = 2;
+	uint64_t scanSeq = 0;
+	// the packed scans, a scan isn't refilled while subscribers hold a view of it.
+	// Subscribers hold at most maxHeldScans, so one more slot is always free
+	struct ScanSlot {
+		A1LidarScan scan;
+		std::atomic<int> refs{0};
+	};
+	static const unsigned maxHeldScans = 8;
+	std::vector<std::unique_ptr<ScanSlot>> scanSlots;
+	ScanSlot *freeScanSlot(unsigned &held);
+	struct Subscription {
+		SubscriberInterface* si;
+		unsigned decimation;
+		unsigned fields;
+		unsigned skipped;
+	};
+	std::vector<Subscription> subscriptions;
+	std::mutex subscriptionMtx;
+	RplidarScanArena scanArena;
+	RplidarScanSoA sortedScan;
+	Cartesian scanCartesian;
 	std::thread* worker = nullptr;
-	float currentRPM = 0;
-	std::mutex readoutMtx;
+	std::thread* motorWorker = nullptr;
+	// scans copied from the driver wait in dispatchQueue, the slots
+	// neither queued nor being dispatched are in dispatchFree
+	struct DispatchSlot {
+		RplidarScanSoA scan;
+		float rpm;
+	};
+	std::thread* dispatcher = nullptr;
+	unsigned dispatchDepth = 0;
+	DispatchPolicy dispatchPolicy = DISPATCH_DROP_OLDEST;
+	RplidarScanArena dispatchArena;
+	std::vector<DispatchSlot> dispatchSlots;
+	std::deque<unsigned> dispatchQueue;
+	std::vector<unsigned> dispatchFree;
+	DispatchStats dispatchStats;
+	std::mutex dispatchMtx;
+	std::condition_variable dispatchCond;
+	std::thread* sectorWorker = nullptr;
+	SectorInterface* sectorInterface = nullptr;
+	unsigned nSectors = 36;
+	unsigned currentSector = 0;
+	unsigned sectorCount = 0;
+	uint64_t sectorStartUs = 0;
+	uint64_t sectorEndUs = 0;
+	std::vector<A1LidarData> sectorData;
+	RplidarScanSoA intervalScan;
+	Cartesian sectorCartesian;
+	std::thread* gridWorker = nullptr;
+	GridInterface* gridInterface = nullptr;
+	unsigned gridBins = 360;
+	unsigned gridPolicy = SCAN_GRID_NEAREST;
+	std::vector<uint32_t> gridDist;
+	std::vector<uint8_t> gridQuality;
+	std::vector<float> gridR;
+	std::vector<float> gridStrength;
+	std::atomic<float> currentRPM{0};
 	int pwmRange = -1;
 	bool doInit = true;
 	bool dataAvailable = false;
-	int currentBufIdx = 0;
 	RPlidarDriver *drv;
 	RplidarScanMode scanMode;
 };
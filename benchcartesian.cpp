@@ -0,0 +1,86 @@
+#include "a1lidarrpi.h"
+
+// Times A1Lidar::toCartesian() on synthetic scans against the same
+// conversion with libm and checks that both agree.
+
+#if defined(__GNUC__) && defined(__SSE2__)
+static const char *simd = "SSE2";
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+static const char *simd = "NEON";
+#else
+static const char *simd = "none";
+#endif
+
+static const int nRuns = 7;
+static const int nScans = 2000;
+
+// one revolution with every 4th reading invalid like a scan in a room
+static void makeScan(RplidarScanSoA &scan, size_t n) {
+	uint32_t random = 12345;
+	for(size_t i = 0; i < n; i++) {
+		random = random * 1103515245 + 12345;
+		scan.angle_z_q14[i] = (uint16_t)(i * 65536 / n);
+		scan.dist_mm_q2[i] = (3 == i % 4) ? 0 : 600 + (random >> 8) % 48000;
+		scan.quality[i] = 47 << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT;
+		scan.flag[i] = (0 == i) ? RPLIDAR_RESP_MEASUREMENT_SYNCBIT : 0;
+		scan.timestamp_us[i] = i * 125;
+	}
+	scan.count = n;
+}
+
+static void toCartesianLibm(const RplidarScanSoA &scan, A1Lidar::Cartesian &cart) {
+	for(size_t i = 0; i < scan.count; i++) {
+		const float phi = (float)M_PI - scan.angle_z_q14[i] * (90.f / 16384.f / (180.0f / M_PI));
+		const float r = scan.dist_mm_q2[i] / 4000.0f;
+		cart.r[i] = r;
+		cart.phi[i] = phi;
+		cart.x[i] = cos(phi) * r;
+		cart.y[i] = sin(phi) * r;
+	}
+}
+
+// best time per scan in us of nRuns runs
+template <class Convert>
+static double timeIt(Convert convert, const RplidarScanSoA &scan, A1Lidar::Cartesian &cart) {
+	double best = 1e9;
+	for(int run = 0; run < nRuns; run++) {
+		const auto t0 = std::chrono::steady_clock::now();
+		for(int i = 0; i < nScans; i++) {
+			convert(scan, cart);
+		}
+		const std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - t0;
+		best = std::min(best, t.count() / nScans);
+	}
+	return best;
+}
+
+int main(int, char **) {
+	const size_t sizes[] = { 800, 1600, 3200 };
+	RplidarScanArena arena;
+	RplidarScanSoA scan;
+	arena.reset(RplidarScanArena::bytesFor(RPlidarDriver::MAX_SCAN_NODES));
+	arena.carve(scan, RPlidarDriver::MAX_SCAN_NODES);
+	A1Lidar::Cartesian cart, ref;
+	cart.resize(RPlidarDriver::MAX_SCAN_NODES);
+	ref.resize(RPlidarDriver::MAX_SCAN_NODES);
+
+	printf("SIMD: %s, best of %d runs of %d scans\n", simd, nRuns, nScans);
+	printf("readings  toCartesian  libm        max deviation\n");
+	bool failed = false;
+	for(size_t n : sizes) {
+		makeScan(scan, n);
+		const double us = timeIt(A1Lidar::toCartesian, scan, cart);
+		const double usLibm = timeIt(toCartesianLibm, scan, ref);
+		float deviation = 0;
+		for(size_t i = 0; i < n; i++) {
+			deviation = std::max(deviation, fabsf(cart.x[i] - ref.x[i]));
+			deviation = std::max(deviation, fabsf(cart.y[i] - ref.y[i]));
+			deviation = std::max(deviation, fabsf(cart.r[i] - ref.r[i]));
+			deviation = std::max(deviation, fabsf(cart.phi[i] - ref.phi[i]));
+		}
+		printf("%8zu  %8.2f us  %8.2f us  %.2e\n", n, us, usLibm, deviation);
+		if (deviation > 1e-5f) failed = true;
+	}
+	if (failed) printf("toCartesian deviates from libm\n");
+	return failed ? 1 : 0;
+}
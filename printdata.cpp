@@ -1,16 +1,15 @@
 #include "a1lidarrpi.h"
 
-class DataInterface : public A1Lidar::DataInterface {
+class ScanInterface : public A1Lidar::ScanInterface {
 public:
-	void newScanAvail(float,A1LidarData (&data)[A1Lidar::nDistance]) {
-		for(A1LidarData &data: data) {
-			if (data.valid)
-				printf("%e\t%e\t%e\t%e\t%e\n",
-				       data.x,
-				       data.y,
-				       data.r,
-				       data.phi,
-				       data.signal_strength);
+	void newScanAvail(float, const A1LidarScan &scan) {
+		for(unsigned i = 0; i < scan.count; i++) {
+			printf("%e\t%e\t%e\t%e\t%e\n",
+			       scan.x[i],
+			       scan.y[i],
+			       scan.r[i],
+			       scan.phi[i],
+			       scan.signal_strength[i]);
 		}
 		fprintf(stderr,".");
 	}
@@ -21,8 +20,8 @@ int main(int, char **) {
 		" x <tab> y <tab> r <tab> phi <tab> strengh\n");
 	fprintf(stderr,"Press any key to stop.\n");
 	A1Lidar lidar;
-	DataInterface dataInterface;
-	lidar.registerInterface(&dataInterface);
+	ScanInterface scanInterface;
+	lidar.registerScanInterface(&scanInterface);
 	lidar.start();
 	do {
 	} while (!getchar());
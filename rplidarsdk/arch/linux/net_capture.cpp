@@ -0,0 +1,275 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2018 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "arch/linux/arch_linux.h"
+#include "arch/linux/net_capture.h"
+
+#include <sys/mman.h>
+
+namespace rp{ namespace arch{ namespace net{
+
+mmap_capture::mmap_capture()
+    : rp::hal::rx_capture()
+    , _segment_size(DEFAULT_SEGMENT_SIZE)
+    , _next_index(0)
+    , _current(NULL)
+    , _next(NULL)
+    , _retired(NULL)
+    , _captured_bytes(0)
+    , _dropped_bytes(0)
+    , _running(false)
+{
+    _basepath[0] = 0;
+}
+
+mmap_capture::~mmap_capture()
+{
+    close();
+}
+
+bool mmap_capture::open(const char * basepath, size_t segment_size)
+{
+    close();
+
+    strncpy(_basepath, basepath, sizeof(_basepath) - 1);
+    _basepath[sizeof(_basepath) - 1] = 0;
+    _segment_size = segment_size ? segment_size : DEFAULT_SEGMENT_SIZE;
+    if (_segment_size < MIN_SEGMENT_SIZE) _segment_size = MIN_SEGMENT_SIZE;
+    _next_index = 0;
+    _captured_bytes = _dropped_bytes = 0;
+
+    // the first two segments are set up here, later ones by the sync thread
+    _current = _createSegment();
+    if (!_current) return false;
+    _next = _createSegment();
+
+    _running = true;
+    _wakeEvt.set(false);
+    _syncthread = CLASS_THREAD(mmap_capture, _syncThread);
+    if (_syncthread.getHandle() == 0) {
+        _running = false;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void mmap_capture::close()
+{
+    if (_running) {
+        _running = false;
+        _wakeEvt.set();
+        _syncthread.join();
+    }
+
+    segment_t * retired = __atomic_exchange_n(&_retired, (segment_t *)NULL, __ATOMIC_ACQ_REL);
+    if (retired) _retireSegment(retired, true);
+    if (_current) _retireSegment(_current, true);
+    segment_t * next = __atomic_exchange_n(&_next, (segment_t *)NULL, __ATOMIC_ACQ_REL);
+    if (next) _retireSegment(next, false);
+    _current = NULL;
+}
+
+void mmap_capture::append(const _u8 * data, size_t size, _u64 timestamp_us)
+{
+    if (!_current || !size) return;
+
+    size_t record_size = sizeof(capture_record_t) + ((size + CAPTURE_RECORD_ALIGN - 1) & ~(size_t)(CAPTURE_RECORD_ALIGN - 1));
+    if (_current->used + record_size > _current->size) {
+        if (!_switchSegment(record_size)) {
+            __atomic_fetch_add(&_dropped_bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    capture_record_t * record = reinterpret_cast<capture_record_t *>(_current->base + _current->used);
+    record->timestamp_ns = timestamp_us * 1000;
+    record->length = (_u32)size;
+    record->reserved = 0;
+    memcpy(record + 1, data, size);
+
+    __atomic_store_n(&_current->used, _current->used + record_size, __ATOMIC_RELEASE);
+    __atomic_store_n(&_captured_bytes, _captured_bytes + size, __ATOMIC_RELAXED);
+}
+
+bool mmap_capture::_switchSegment(size_t record_size)
+{
+    // _retired holds a single segment, never overwrite one the sync thread hasn't
+    // collected yet: it would never be synced, unmapped or truncated
+    if (__atomic_load_n(&_retired, __ATOMIC_ACQUIRE)) return false;
+
+    segment_t * next = __atomic_exchange_n(&_next, (segment_t *)NULL, __ATOMIC_ACQ_REL);
+    if (!next) return false;
+    if (next->used + record_size > next->size) {
+        // larger than a whole segment, keep the spare for the next chunk
+        __atomic_store_n(&_next, next, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    __atomic_store_n(&_retired, _current, __ATOMIC_RELEASE);
+    __atomic_store_n(&_current, next, __ATOMIC_RELEASE);
+    _wakeEvt.set();
+    return true;
+}
+
+_u64 mmap_capture::getCapturedBytes()
+{
+    return __atomic_load_n(&_captured_bytes, __ATOMIC_RELAXED);
+}
+
+_u64 mmap_capture::getDroppedBytes()
+{
+    return __atomic_load_n(&_dropped_bytes, __ATOMIC_RELAXED);
+}
+
+mmap_capture::segment_t * mmap_capture::_createSegment()
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s_%04u.rpcap", _basepath, _next_index);
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return NULL;
+
+    // reserve the blocks now rather than on the first write fault
+    if (posix_fallocate(fd, 0, _segment_size) != 0 && ftruncate(fd, _segment_size) != 0) {
+        ::close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    _u8 * base = (_u8 *)mmap(NULL, _segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    segment_t * seg = new segment_t;
+    seg->fd = fd;
+    seg->base = base;
+    seg->size = _segment_size;
+    seg->index = _next_index++;
+
+    capture_file_header_t * header = reinterpret_cast<capture_file_header_t *>(base);
+    memcpy(header->magic, Magic(), sizeof(header->magic));
+    header->header_size = sizeof(capture_file_header_t);
+    header->segment_index = seg->index;
+    seg->used = sizeof(capture_file_header_t);
+    seg->synced = 0;
+    _prefaultSegment(seg);
+    return seg;
+}
+
+void mmap_capture::_syncSegment(segment_t * seg, bool wait)
+{
+    size_t used = __atomic_load_n(&seg->used, __ATOMIC_ACQUIRE);
+    if (used == seg->synced) return;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from = seg->synced & ~(page - 1);
+    msync(seg->base + from, used - from, wait ? MS_SYNC : MS_ASYNC);
+    seg->synced = used;
+}
+
+void mmap_capture::_prefaultSegment(segment_t * seg)
+{
+#ifdef MADV_POPULATE_WRITE
+    // MAP_POPULATE maps the pages of a shared file read only, the first store to a page
+    // faults and so does the first one after writeback cleaned it. Keep the part ahead of
+    // the receiver writable; older kernels fail with EINVAL and the receiver takes the faults
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from = __atomic_load_n(&seg->used, __ATOMIC_ACQUIRE) & ~(page - 1);
+    size_t to = from + PREFAULT_SIZE;
+    if (to > seg->size) to = seg->size;
+    if (to > from) madvise(seg->base + from, to - from, MADV_POPULATE_WRITE);
+#endif
+}
+
+void mmap_capture::_retireSegment(segment_t * seg, bool keep)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s_%04u.rpcap", _basepath, seg->index);
+
+    if (keep) _syncSegment(seg, true);
+    munmap(seg->base, seg->size);
+    if (keep) {
+        // drop the unused preallocated tail
+        if (ftruncate(seg->fd, seg->used) != 0) {}
+    } else {
+        unlink(path);
+    }
+    ::close(seg->fd);
+    delete seg;
+}
+
+u_result mmap_capture::_syncThread()
+{
+    while (_running) {
+        _wakeEvt.wait(SYNC_INTERVAL_MS);
+
+        segment_t * retired = __atomic_exchange_n(&_retired, (segment_t *)NULL, __ATOMIC_ACQ_REL);
+        if (retired) _retireSegment(retired, true);
+
+        if (!__atomic_load_n(&_next, __ATOMIC_ACQUIRE)) {
+            segment_t * seg = _createSegment();
+            if (seg) __atomic_store_n(&_next, seg, __ATOMIC_RELEASE);
+        }
+
+        // only this thread unmaps segments, so the current one stays valid here
+        segment_t * current = __atomic_load_n(&_current, __ATOMIC_ACQUIRE);
+        if (current) {
+            _syncSegment(current, false);
+            _prefaultSegment(current);
+        }
+    }
+    return RESULT_OK;
+}
+
+}}} //end rp::arch::net
+
+//begin rp::hal
+namespace rp{ namespace hal{
+
+rx_capture * rx_capture::CreateCapture()
+{
+    return new rp::arch::net::mmap_capture();
+}
+
+void rx_capture::ReleaseCapture(rx_capture * capture)
+{
+    delete capture;
+}
+
+}} //end rp::hal
@@ -0,0 +1,103 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2018 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#pragma once
+
+#include "hal/abs_capture.h"
+#include "hal/thread.h"
+#include "hal/event.h"
+
+namespace rp{ namespace arch{ namespace net{
+
+// rx_capture on preallocated, memory mapped segment files. append() only
+// writes into the mapping; a background thread msyncs the written part,
+// finalizes full segments, maps the next one ahead of time and faults in
+// the pages ahead of the write position writable, so the receiving thread
+// neither touches the disk nor takes page faults. Chunks arriving while no
+// segment is ready are counted as dropped.
+class mmap_capture : public rp::hal::rx_capture
+{
+public:
+    enum {
+        DEFAULT_SEGMENT_SIZE = 64*1024*1024,
+        MIN_SEGMENT_SIZE     = 64*1024,
+        SYNC_INTERVAL_MS     = 500,
+        PREFAULT_SIZE        = 256*1024,
+    };
+
+    mmap_capture();
+    virtual ~mmap_capture();
+
+    virtual bool open(const char * basepath, size_t segment_size = 0);
+    virtual void close();
+    virtual void append(const _u8 * data, size_t size, _u64 timestamp_us);
+
+    virtual _u64 getCapturedBytes();
+    virtual _u64 getDroppedBytes();
+
+protected:
+    struct segment_t {
+        int    fd;
+        _u8  * base;
+        size_t size;
+        size_t used;     // written by the receiving thread
+        size_t synced;   // msync'd by the background thread
+        _u32   index;
+    };
+
+    bool _switchSegment(size_t record_size);
+    segment_t * _createSegment();
+    void _syncSegment(segment_t * seg, bool wait);
+    void _prefaultSegment(segment_t * seg);
+    void _retireSegment(segment_t * seg, bool keep);
+    u_result _syncThread();
+
+    char   _basepath[256];
+    size_t _segment_size;
+    _u32   _next_index;
+
+    segment_t * _current;   // owned by the receiving thread
+    segment_t * _next;      // handed from the background thread to the receiver
+    segment_t * _retired;   // handed from the receiver to the background thread
+
+    _u64   _captured_bytes; // only the receiving thread writes it
+    _u64   _dropped_bytes;
+
+    bool   _running;
+    rp::hal::Event  _wakeEvt;
+    rp::hal::Thread _syncthread;
+};
+
+}}}
@@ -46,7 +46,10 @@
 #include <time.h>
 #include "hal/types.h"
 #include "arch/linux/net_serial.h"
-#include <sys/select.h>
+#include "arch/linux/net_serial_uring.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include <algorithm>
 //__GNUC__
@@ -200,28 +203,86 @@ bool raw_serial::open(const char * portname, uint32_t baudrate, uint32_t flags)
 
     //Clear the DTR bit to let the motor spin
     clearDTR();
-    do {
-        // create self pipeline for wait cancellation
-        if (pipe(_selfpipe) == -1) break;
 
-        int flags = fcntl(_selfpipe[0], F_GETFL);
-        if (flags == -1)
-            break;
+    if (!_setupWaitContext())
+    {
+        close();
+        return false;
+    }
 
-        flags |= O_NONBLOCK;                /* Make read end nonblocking */
-        if (fcntl(_selfpipe[0], F_SETFL, flags) == -1)
-            break;
+    return true;
+}
 
-        flags = fcntl(_selfpipe[1], F_GETFL);
-        if (flags == -1)
-            break;
+bool raw_serial::_setupWaitContext()
+{
+    _releaseWaitContext();
 
-        flags |= O_NONBLOCK;                /* Make write end nonblocking */
-        if (fcntl(_selfpipe[1], F_SETFL, flags) == -1)
-            break;
+    _epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+    _cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _timer_fd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_epoll_fd == -1 || _cancel_fd == -1 || _timer_fd == -1) return false;
 
-    } while (0);
-    
+    int fds[] = {serial_fd, _cancel_fd, _timer_fd};
+    for (size_t pos = 0; pos < sizeof(fds)/sizeof(fds[0]); ++pos)
+    {
+        struct epoll_event evt;
+        memset(&evt, 0, sizeof(evt));
+        evt.events = EPOLLIN;
+        evt.data.fd = fds[pos];
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fds[pos], &evt) == -1) return false;
+    }
+    _timer_armed = 0;
+    _rx_edge = false;
+    return true;
+}
+
+void raw_serial::_releaseWaitContext()
+{
+    if (_epoll_fd != -1)  ::close(_epoll_fd);
+    if (_cancel_fd != -1) ::close(_cancel_fd);
+    if (_timer_fd != -1)  ::close(_timer_fd);
+    _epoll_fd = _cancel_fd = _timer_fd = -1;
+    _timer_armed = 0;
+    _rx_edge = false;
+}
+
+void raw_serial::_setRxMinimum(size_t data_count)
+{
+    // n_tty only reports the port readable once VMIN bytes are queued (VTIME == 0),
+    // so the kernel does the counting and we are woken exactly once per request.
+    // O_NDELAY keeps read() itself from blocking on it.
+    int vmin = (int)std::min<size_t>(std::max<size_t>(data_count, 1), 255);
+    if (vmin == _rx_vmin) return;
+
+#if !defined(__GNUC__)
+    struct termios options;
+    if (tcgetattr(serial_fd, &options)) return;
+    options.c_cc[VMIN] = vmin;
+    options.c_cc[VTIME] = 0;
+    if (tcsetattr(serial_fd, TCSANOW, &options)) return;
+#else
+    struct termios2 tio;
+    if (ioctl(serial_fd, TCGETS2, &tio) == -1) return;
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(serial_fd, TCSETS2, &tio) == -1) return;
+#endif
+    _rx_vmin = vmin;
+}
+
+bool raw_serial::_armDeadline(_u64 deadline)
+{
+    // an earlier deadline that is still pending is good enough: when it fires
+    // before ours the wait loop simply re-arms. With the usual constant timeout
+    // this keeps timerfd_settime() out of the per-frame path.
+    if (_timer_armed && _timer_armed <= deadline) return true;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec  = deadline / 1000000;
+    spec.it_value.tv_nsec = (deadline % 1000000) * 1000;
+    if (timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) return false;
+    _timer_armed = deadline;
     return true;
 }
 
@@ -231,13 +292,8 @@ void raw_serial::close()
         ::close(serial_fd);
     serial_fd = -1;
     
-    if (_selfpipe[0] != -1)
-        ::close(_selfpipe[0]);
-
-    if (_selfpipe[1] != -1)
-        ::close(_selfpipe[1]);
-
-    _selfpipe[0] = _selfpipe[1] = -1;
+    _releaseWaitContext();
+    _rx_vmin = 0;
 
     _operation_aborted = false;
     _is_serial_opened = false;
@@ -303,87 +359,113 @@ int raw_serial::waitfordata(size_t data_count, _u32 timeout, size_t * returned_s
     if (returned_size==NULL) returned_size=(size_t *)&length;
     *returned_size = 0;
 
-    int max_fd;
-    fd_set input_set;
-    struct timeval timeout_val;
-
-    /* Initialize the input set */
-    FD_ZERO(&input_set);
-    FD_SET(serial_fd, &input_set);
+    if (!isOpened() || _epoll_fd == -1) return ANS_DEV_ERR;
 
-    if (_selfpipe[0] != -1)
-        FD_SET(_selfpipe[0], &input_set);
+    _setRxMinimum(data_count);
 
-    max_fd =  std::max<int>(serial_fd, _selfpipe[0]) + 1;
-
-    /* Initialize the timeout structure */
-    timeout_val.tv_sec = timeout / 1000;
-    timeout_val.tv_usec = (timeout % 1000) * 1000;
-
-    if ( isOpened() )
+    _u64 deadline = 0;
+    if (timeout != (_u32)-1)
     {
-        if ( ioctl(serial_fd, FIONREAD, returned_size) == -1) return ANS_DEV_ERR;
-        if (*returned_size >= data_count)
-        {
-            return 0;
-        }
+        deadline = rp::arch::rp_getus() + (_u64)timeout * 1000;
+        if (!_armDeadline(deadline)) return ANS_DEV_ERR;
     }
 
+    int ans = ANS_DEV_ERR;
     while ( isOpened() )
     {
-        /* Do the select */
-        int n = ::select(max_fd, &input_set, NULL, NULL, &timeout_val);
+        struct epoll_event evts[3];
+        int n = epoll_wait(_epoll_fd, evts, 3, -1);
 
         if (n < 0)
         {
-            // select error
-            *returned_size =  0;
-            return ANS_DEV_ERR;
-        }
-        else if (n == 0)
-        {
-            // time out
-            *returned_size =0;
-            return ANS_TIMEOUT;
+            if (errno == EINTR) continue;
+            *returned_size = 0;
+            break;
         }
-        else
+
+        bool rx_ready = false;
+        bool expired  = false;
+        bool aborted  = false;
+        for (int pos = 0; pos < n; ++pos)
         {
-            if (FD_ISSET(_selfpipe[0], &input_set)) {   
+            _u64 counter;
+            if (evts[pos].data.fd == _cancel_fd)
+            {
                 // require aborting the current operation
-                int ch;
-                for (;;) {                    
-                    if (::read(_selfpipe[0], &ch, 1) == -1) {
-                        break;
-                    }
-                    
-                }
-
-                // treat as  timeout
-                *returned_size = 0;
-                return ANS_TIMEOUT;
+                if (::read(_cancel_fd, &counter, sizeof(counter)) == -1) {}
+                aborted = true;
             }
+            else if (evts[pos].data.fd == _timer_fd)
+            {
+                if (::read(_timer_fd, &counter, sizeof(counter)) == -1) {}
+                _timer_armed = 0;
+                expired = true;
+            }
+            else
+            {
+                rx_ready = true;
+            }
+        }
 
-            // data avaliable
-            assert (FD_ISSET(serial_fd, &input_set));
-
+        if (aborted)
+        {
+            // treat as  timeout
+            *returned_size = 0;
+            ans = ANS_TIMEOUT;
+            break;
+        }
 
-            if ( ioctl(serial_fd, FIONREAD, returned_size) == -1) return ANS_DEV_ERR;
+        if (rx_ready)
+        {
+            // readable implies at least VMIN bytes are queued, no need to ask
+            if (data_count <= (size_t)_rx_vmin)
+            {
+                *returned_size = data_count;
+                ans = 0;
+                break;
+            }
+            if ( ioctl(serial_fd, FIONREAD, returned_size) == -1) break;
             if (*returned_size >= data_count)
             {
-                return 0;
+                ans = 0;
+                break;
             }
-            else 
+            // more than VMIN can express: stay readable-level no longer, wait
+            // for each further arrival instead of spinning on the queued part
+            if (!_rx_edge)
             {
-                int remain_timeout = timeout_val.tv_sec*1000000 + timeout_val.tv_usec;
-                int expect_remain_time = (data_count - *returned_size)*1000000*8/_baudrate;
-                if (remain_timeout > expect_remain_time)
-                    usleep(expect_remain_time);
+                struct epoll_event evt;
+                memset(&evt, 0, sizeof(evt));
+                evt.events = EPOLLIN | EPOLLET;
+                evt.data.fd = serial_fd;
+                if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, serial_fd, &evt) == -1) break;
+                _rx_edge = true;
             }
         }
-        
+
+        if (expired && deadline)
+        {
+            if (rp::arch::rp_getus() >= deadline)
+            {
+                // time out
+                *returned_size = 0;
+                ans = ANS_TIMEOUT;
+                break;
+            }
+            if (!_armDeadline(deadline)) break;
+        }
     }
 
-    return ANS_DEV_ERR;
+    if (_rx_edge && _epoll_fd != -1)
+    {
+        struct epoll_event evt;
+        memset(&evt, 0, sizeof(evt));
+        evt.events = EPOLLIN;
+        evt.data.fd = serial_fd;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, serial_fd, &evt);
+        _rx_edge = false;
+    }
+    return ans;
 }
 
 size_t raw_serial::rxqueue_count()
@@ -417,15 +499,19 @@ void raw_serial::_init()
     _portName[0] = 0;
     required_tx_cnt = required_rx_cnt = 0;
     _operation_aborted = false;
-    _selfpipe[0] = _selfpipe[1] = -1;
+    _epoll_fd = _cancel_fd = _timer_fd = -1;
+    _timer_armed = 0;
+    _rx_vmin = 0;
+    _rx_edge = false;
 }
 
 void raw_serial::cancelOperation()
 {
     _operation_aborted = true;
-    if (_selfpipe[1] == -1) return;
+    if (_cancel_fd == -1) return;
 
-    ::write(_selfpipe[1], "x", 1);
+    _u64 one = 1;
+    if (::write(_cancel_fd, &one, sizeof(one)) == -1) return;
 }
 
 _u32 raw_serial::getTermBaudBitmap(_u32 baud)
@@ -463,8 +549,10 @@ switch (baud) {
 //begin rp::hal
 namespace rp{ namespace hal{
 
-serial_rxtx * serial_rxtx::CreateRxTx()
+serial_rxtx * serial_rxtx::CreateRxTx(_u32 type)
 {
+    if (type == RXTX_TYPE_IOURING && rp::arch::net::uring_serial::IsSupported())
+        return new rp::arch::net::uring_serial();
     return new rp::arch::net::raw_serial();
 }
 
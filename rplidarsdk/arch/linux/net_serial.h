@@ -73,6 +73,10 @@ public:
 protected:
     bool open(const char * portname, uint32_t baudrate, uint32_t flags = 0);
     void _init();
+    bool _setupWaitContext();
+    void _releaseWaitContext();
+    void _setRxMinimum(size_t data_count);
+    bool _armDeadline(_u64 deadline);
 
     char _portName[200];
     uint32_t _baudrate;
@@ -83,7 +87,12 @@ protected:
     size_t required_tx_cnt;
     size_t required_rx_cnt;
 
-    int    _selfpipe[2];
+    int    _epoll_fd;     // persistent poll set: serial_fd, _cancel_fd, _timer_fd
+    int    _cancel_fd;    // eventfd signalled by cancelOperation()
+    int    _timer_fd;     // CLOCK_MONOTONIC timerfd carrying the wait deadline
+    _u64   _timer_armed;  // absolute deadline (us) the timerfd is armed for, 0 if idle
+    int    _rx_vmin;      // VMIN currently programmed into the tty
+    bool   _rx_edge;      // serial_fd temporarily edge triggered (request > VMIN)
     bool   _operation_aborted;
 };
 
@@ -0,0 +1,471 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2018 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "arch/linux/arch_linux.h"
+#include "arch/linux/net_serial_uring.h"
+
+#if RP_SERIAL_HAS_IO_URING
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace rp{ namespace arch{ namespace net{
+
+#if RP_SERIAL_HAS_IO_URING
+
+enum {
+    URING_QUEUE_DEPTH      = 8,
+    URING_TAG_CANCEL_POLL  = 0x100,
+    URING_TAG_ASYNC_CANCEL = 0x101,
+};
+
+static int _uring_setup(unsigned entries, struct io_uring_params * p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void * arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int _uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool uring_serial::IsSupported()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = _uring_setup(2, &p);
+    if (fd < 0) return false;
+    ::close(fd);
+    // the timed wait relies on IORING_ENTER_EXT_ARG (5.11+)
+    return (p.features & IORING_FEAT_EXT_ARG) != 0;
+}
+
+uring_serial::uring_serial()
+    : raw_serial()
+    , _ring_fd(-1)
+    , _sq_map(NULL), _sq_map_size(0)
+    , _cq_map(NULL), _cq_map_size(0)
+    , _sqe_map(NULL), _sqe_map_size(0)
+{
+    _releaseRing();
+}
+
+uring_serial::~uring_serial()
+{
+    close();
+}
+
+bool uring_serial::open()
+{
+    if (!raw_serial::open()) return false;
+
+    // keep serving through the epoll path if the ring is not available
+    if (!_setupRing()) _releaseRing();
+    return true;
+}
+
+void uring_serial::close()
+{
+    _releaseRing();
+    raw_serial::close();
+}
+
+void uring_serial::flush( _u32 flags)
+{
+    raw_serial::flush(flags);
+
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        if (_rx_state[pos] != RXBUF_FILLED) continue;
+        _rx_state[pos] = RXBUF_FREE;
+        _rx_len[pos] = _rx_pos[pos] = 0;
+    }
+    _rx_next_drain = _rx_next_fill;
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        if (_rx_state[pos] == RXBUF_INFLIGHT) _rx_next_drain = pos;
+    }
+}
+
+bool uring_serial::_setupRing()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    _ring_fd = _uring_setup(URING_QUEUE_DEPTH, &p);
+    if (_ring_fd < 0) return false;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) return false;
+
+    _sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _sq_map_size = _cq_map_size = std::max(_sq_map_size, _cq_map_size);
+    }
+
+    _sq_map = mmap(NULL, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_map == MAP_FAILED) { _sq_map = NULL; return false; }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _cq_map = _sq_map;
+    }
+    else
+    {
+        _cq_map = mmap(NULL, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+        if (_cq_map == MAP_FAILED) { _cq_map = NULL; return false; }
+    }
+
+    _sqe_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    _sqe_map = mmap(NULL, _sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+    if (_sqe_map == MAP_FAILED) { _sqe_map = NULL; return false; }
+
+    _u8 * sq = (_u8 *)_sq_map;
+    _u8 * cq = (_u8 *)_cq_map;
+    _sq_head  = (unsigned *)(sq + p.sq_off.head);
+    _sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    _sq_mask  = *(unsigned *)(sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned *)(sq + p.sq_off.array);
+    _cq_head  = (unsigned *)(cq + p.cq_off.head);
+    _cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    _cq_mask  = *(unsigned *)(cq + p.cq_off.ring_mask);
+    _cqes     = cq + p.cq_off.cqes;
+    _sqes     = _sqe_map;
+
+    // pin the receive buffers once so every read skips the page lookups
+    struct iovec iov[URING_RX_BUFFER_COUNT];
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        iov[pos].iov_base = _rx_buf[pos];
+        iov[pos].iov_len  = URING_RX_BUFFER_SIZE;
+    }
+    if (_uring_register(_ring_fd, IORING_REGISTER_BUFFERS, iov, URING_RX_BUFFER_COUNT) < 0) return false;
+
+    // reads are completed by the ring, not retried by us: the tty has to block
+    // (O_NONBLOCK would turn every queued read into -EAGAIN) and must never
+    // report end of data on an empty queue, hence VMIN >= 1
+    int flags = fcntl(serial_fd, F_GETFL);
+    if (flags == -1 || fcntl(serial_fd, F_SETFL, flags & ~O_NONBLOCK) == -1) return false;
+    _setRxMinimum(1);
+    return true;
+}
+
+void uring_serial::_releaseRing()
+{
+    if (_ring_fd != -1 && _sqes)
+    {
+        // the kernel may still write into a registered buffer: cancel the queued
+        // read and wait for it to retire before the buffers can go away
+        bool inflight = false;
+        for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+        {
+            if (_rx_state[pos] == RXBUF_INFLIGHT)
+            {
+                unsigned tail = *_sq_tail;
+                struct io_uring_sqe * sqe = (struct io_uring_sqe *)_sqes + (tail & _sq_mask);
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+                sqe->fd        = -1;
+                sqe->addr      = pos;
+                sqe->user_data = URING_TAG_ASYNC_CANCEL;
+                _sq_array[tail & _sq_mask] = tail & _sq_mask;
+                __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+                inflight = true;
+            }
+        }
+
+        _u64 deadline = rp::arch::rp_getus() + 500*1000;
+        while (inflight && rp::arch::rp_getus() < deadline)
+        {
+            struct __kernel_timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 10*1000*1000;
+            struct io_uring_getevents_arg arg;
+            memset(&arg, 0, sizeof(arg));
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = (_u64)(size_t)&ts;
+            _uring_enter(_ring_fd, *_sq_tail - *_sq_head, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+            bool aborted;
+            _reapCompletions(aborted);
+            inflight = false;
+            for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+            {
+                if (_rx_state[pos] == RXBUF_INFLIGHT) inflight = true;
+            }
+        }
+    }
+
+    if (_sqe_map) munmap(_sqe_map, _sqe_map_size);
+    if (_cq_map && _cq_map != _sq_map) munmap(_cq_map, _cq_map_size);
+    if (_sq_map) munmap(_sq_map, _sq_map_size);
+    if (_ring_fd != -1) ::close(_ring_fd);
+
+    _ring_fd = -1;
+    _sq_map = _cq_map = _sqe_map = NULL;
+    _sq_map_size = _cq_map_size = _sqe_map_size = 0;
+    _sq_head = _sq_tail = _sq_array = _cq_head = _cq_tail = NULL;
+    _sq_mask = _cq_mask = 0;
+    _cqes = _sqes = NULL;
+
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        _rx_state[pos] = RXBUF_FREE;
+        _rx_len[pos] = _rx_pos[pos] = 0;
+    }
+    _rx_next_fill = _rx_next_drain = 0;
+    _cancel_armed = false;
+}
+
+void uring_serial::_reapCompletions(bool & aborted)
+{
+    aborted = false;
+
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        struct io_uring_cqe * cqe = (struct io_uring_cqe *)_cqes + (head & _cq_mask);
+
+        if (cqe->user_data == URING_TAG_CANCEL_POLL)
+        {
+            _u64 counter;
+            if (::read(_cancel_fd, &counter, sizeof(counter)) == -1) {}
+            _cancel_armed = false;
+            aborted = true;
+        }
+        else if (cqe->user_data < URING_RX_BUFFER_COUNT)
+        {
+            int pos = (int)cqe->user_data;
+            if (cqe->res > 0)
+            {
+                _rx_state[pos] = RXBUF_FILLED;
+                _rx_len[pos] = cqe->res;
+                _rx_pos[pos] = 0;
+            }
+            else
+            {
+                // nothing read (interrupted, cancelled or hung up): recycle in place
+                _rx_state[pos] = RXBUF_FREE;
+                _rx_next_fill = pos;
+            }
+        }
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
+
+void uring_serial::_queueRequests(unsigned & to_submit)
+{
+    unsigned tail = *_sq_tail;
+
+    if (!_cancel_armed && _cancel_fd != -1)
+    {
+        struct io_uring_sqe * sqe = (struct io_uring_sqe *)_sqes + (tail & _sq_mask);
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = _cancel_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data     = URING_TAG_CANCEL_POLL;
+        _sq_array[tail & _sq_mask] = tail & _sq_mask;
+        ++tail;
+        _cancel_armed = true;
+    }
+
+    bool inflight = false;
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        if (_rx_state[pos] == RXBUF_INFLIGHT) inflight = true;
+    }
+
+    // one read at a time keeps the byte order trivially intact
+    if (!inflight && _rx_state[_rx_next_fill] == RXBUF_FREE)
+    {
+        int pos = _rx_next_fill;
+        struct io_uring_sqe * sqe = (struct io_uring_sqe *)_sqes + (tail & _sq_mask);
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_READ_FIXED;
+        sqe->fd        = serial_fd;
+        sqe->addr      = (_u64)(size_t)_rx_buf[pos];
+        sqe->len       = URING_RX_BUFFER_SIZE;
+        sqe->off       = (_u64)-1;
+        sqe->buf_index = pos;
+        sqe->user_data = pos;
+        _sq_array[tail & _sq_mask] = tail & _sq_mask;
+        ++tail;
+        _rx_state[pos] = RXBUF_INFLIGHT;
+        _rx_next_fill = (pos + 1) % URING_RX_BUFFER_COUNT;
+    }
+
+    __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+    to_submit = tail - *_sq_head;
+}
+
+size_t uring_serial::_bufferedBytes() const
+{
+    size_t total = 0;
+    for (int pos = 0; pos < URING_RX_BUFFER_COUNT; ++pos)
+    {
+        if (_rx_state[pos] == RXBUF_FILLED) total += _rx_len[pos] - _rx_pos[pos];
+    }
+    return total;
+}
+
+int uring_serial::waitfordata(size_t data_count, _u32 timeout, size_t * returned_size)
+{
+    if (!isRingActive()) return raw_serial::waitfordata(data_count, timeout, returned_size);
+
+    size_t length = 0;
+    if (returned_size==NULL) returned_size=(size_t *)&length;
+    *returned_size = 0;
+
+    _u64 deadline = 0;
+    if (timeout != (_u32)-1) deadline = rp::arch::rp_getus() + (_u64)timeout * 1000;
+
+    while ( isOpened() )
+    {
+        bool aborted;
+        _reapCompletions(aborted);
+        if (aborted)
+        {
+            // treat as  timeout
+            return ANS_TIMEOUT;
+        }
+
+        size_t avail = _bufferedBytes();
+        if (avail >= data_count)
+        {
+            *returned_size = avail;
+            return 0;
+        }
+
+        // the queued read completes once the rest of the request is there. The
+        // tty does not support non-blocking reads from the ring, it arms poll and
+        // then reads blocking, and a blocking read with VMIN > 64 hands out only
+        // 64 bytes and leaves the rest until VMIN more arrive: stay at 64.
+        _setRxMinimum(std::min<size_t>(data_count - avail, 64));
+
+        unsigned to_submit;
+        _queueRequests(to_submit);
+
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (deadline)
+        {
+            _u64 now = rp::arch::rp_getus();
+            if (now >= deadline)
+            {
+                // time out
+                return ANS_TIMEOUT;
+            }
+            ts.tv_sec  = (deadline - now) / 1000000;
+            ts.tv_nsec = ((deadline - now) % 1000000) * 1000;
+            arg.ts = (_u64)(size_t)&ts;
+        }
+
+        int ans = _uring_enter(_ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (ans < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return ANS_DEV_ERR;
+        }
+    }
+    return ANS_DEV_ERR;
+}
+
+int uring_serial::recvdata(unsigned char * data, size_t size)
+{
+    if (!isRingActive()) return raw_serial::recvdata(data, size);
+    if (!isOpened()) return 0;
+
+    bool aborted;
+    _reapCompletions(aborted);
+    if (aborted)
+    {
+        // keep the cancellation for the next wait
+        _u64 one = 1;
+        if (::write(_cancel_fd, &one, sizeof(one)) == -1) {}
+    }
+
+    size_t copied = 0;
+    while (copied < size && _rx_state[_rx_next_drain] == RXBUF_FILLED)
+    {
+        int pos = _rx_next_drain;
+        size_t chunk = std::min(size - copied, _rx_len[pos] - _rx_pos[pos]);
+        memcpy(data + copied, _rx_buf[pos] + _rx_pos[pos], chunk);
+        _rx_pos[pos] += chunk;
+        copied += chunk;
+        if (_rx_pos[pos] == _rx_len[pos])
+        {
+            _rx_state[pos] = RXBUF_FREE;
+            _rx_len[pos] = _rx_pos[pos] = 0;
+            _rx_next_drain = (pos + 1) % URING_RX_BUFFER_COUNT;
+        }
+    }
+    required_rx_cnt = copied;
+    return (int)copied;
+}
+
+size_t uring_serial::rxqueue_count()
+{
+    if (!isRingActive()) return raw_serial::rxqueue_count();
+    return _bufferedBytes() + raw_serial::rxqueue_count();
+}
+
+#else // !RP_SERIAL_HAS_IO_URING
+
+// built against kernel headers without io_uring: plain raw_serial
+
+bool uring_serial::IsSupported() { return false; }
+uring_serial::uring_serial() : raw_serial(), _ring_fd(-1) {}
+uring_serial::~uring_serial() {}
+bool uring_serial::open() { return raw_serial::open(); }
+void uring_serial::close() { raw_serial::close(); }
+void uring_serial::flush( _u32 flags) { raw_serial::flush(flags); }
+int uring_serial::waitfordata(size_t data_count, _u32 timeout, size_t * returned_size) { return raw_serial::waitfordata(data_count, timeout, returned_size); }
+int uring_serial::recvdata(unsigned char * data, size_t size) { return raw_serial::recvdata(data, size); }
+size_t uring_serial::rxqueue_count() { return raw_serial::rxqueue_count(); }
+
+#endif
+
+}}} //end rp::arch::net
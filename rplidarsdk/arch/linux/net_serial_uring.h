@@ -0,0 +1,120 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2018 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#pragma once
+
+#include "arch/linux/net_serial.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_FEAT_EXT_ARG)
+#define RP_SERIAL_HAS_IO_URING 1
+#else
+#define RP_SERIAL_HAS_IO_URING 0
+#endif
+
+namespace rp{ namespace arch{ namespace net{
+
+// serial receive path through io_uring: a READ_FIXED into one of two registered
+// buffers stays queued on the tty at all times and is resubmitted in the same
+// io_uring_enter() that waits for it, so each batch of bytes costs one syscall.
+// Behaves exactly like raw_serial when the ring cannot be set up.
+class uring_serial : public raw_serial
+{
+public:
+    enum{
+        URING_RX_BUFFER_COUNT = 2,
+        URING_RX_BUFFER_SIZE  = 4096,
+    };
+
+    static bool IsSupported();
+
+    uring_serial();
+    virtual ~uring_serial();
+    virtual bool open();
+    virtual void close();
+    virtual void flush( _u32 flags);
+
+    virtual int waitfordata(size_t data_count,_u32 timeout = -1, size_t * returned_size = NULL);
+    virtual int recvdata(unsigned char * data, size_t size);
+    virtual size_t rxqueue_count();
+
+    bool isRingActive() const { return _ring_fd != -1; }
+
+protected:
+    enum {
+        RXBUF_FREE = 0,
+        RXBUF_INFLIGHT,
+        RXBUF_FILLED,
+    };
+
+    bool _setupRing();
+    void _releaseRing();
+    void _reapCompletions(bool & aborted);
+    void _queueRequests(unsigned & to_submit);
+    size_t _bufferedBytes() const;
+
+    int    _ring_fd;
+    void * _sq_map;
+    size_t _sq_map_size;
+    void * _cq_map;
+    size_t _cq_map_size;
+    void * _sqe_map;
+    size_t _sqe_map_size;
+
+    unsigned * _sq_head;
+    unsigned * _sq_tail;
+    unsigned   _sq_mask;
+    unsigned * _sq_array;
+    unsigned * _cq_head;
+    unsigned * _cq_tail;
+    unsigned   _cq_mask;
+    void     * _cqes;
+    void     * _sqes;
+
+    _u8    _rx_buf[URING_RX_BUFFER_COUNT][URING_RX_BUFFER_SIZE];
+    int    _rx_state[URING_RX_BUFFER_COUNT];
+    size_t _rx_len[URING_RX_BUFFER_COUNT];
+    size_t _rx_pos[URING_RX_BUFFER_COUNT];
+    int    _rx_next_fill;    // buffer the next read lands in
+    int    _rx_next_drain;   // oldest filled buffer
+    bool   _cancel_armed;    // POLL_ADD on the cancel eventfd queued
+};
+
+}}}
@@ -34,6 +34,7 @@
 
 #include "arch/macOS/arch_macOS.h"
 #include "arch/macOS/net_serial.h"
+#include "hal/abs_capture.h"
 #include <termios.h>
 #include <sys/select.h>
 #include <IOKit/serial/ioss.h>
@@ -332,7 +333,7 @@ _u32 raw_serial::getTermBaudBitmap(_u32 baud)
 //begin rp::hal
 namespace rp{ namespace hal{
     
-    serial_rxtx * serial_rxtx::CreateRxTx()
+    serial_rxtx * serial_rxtx::CreateRxTx(_u32 type)
     {
         return new rp::arch::net::raw_serial();
     }
@@ -341,5 +342,16 @@ namespace rp{ namespace hal{
     {
         delete rxtx;
     }
+
+    rx_capture * rx_capture::CreateCapture()
+    {
+        // not supported on this platform
+        return NULL;
+    }
+
+    void rx_capture::ReleaseCapture(rx_capture * capture)
+    {
+        delete capture;
+    }
     
 }} //end rp::hal
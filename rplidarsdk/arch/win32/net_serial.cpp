@@ -34,6 +34,7 @@
 
 #include "sdkcommon.h"
 #include "net_serial.h"
+#include "hal/abs_capture.h"
 
 namespace rp{ namespace arch{ namespace net{
 
@@ -344,7 +345,7 @@ void raw_serial::_init()
 //begin rp::hal
 namespace rp{ namespace hal{
 
-serial_rxtx * serial_rxtx::CreateRxTx()
+serial_rxtx * serial_rxtx::CreateRxTx(_u32 type)
 {
     return new rp::arch::net::raw_serial();
 }
@@ -354,5 +355,16 @@ void  serial_rxtx::ReleaseRxTx( serial_rxtx * rxtx)
     delete rxtx;
 }
 
+rx_capture * rx_capture::CreateCapture()
+{
+    // not supported on this platform
+    return NULL;
+}
+
+void rx_capture::ReleaseCapture( rx_capture * capture)
+{
+    delete capture;
+}
+
 
 }} //end rp::hal
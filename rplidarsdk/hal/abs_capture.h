@@ -0,0 +1,91 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2019 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; 
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include "hal/types.h"
+
+namespace rp{ namespace hal{
+
+// Tee for the raw bytes received from the device. Each chunk is stored as
+// a record { _u64 CLOCK_MONOTONIC ns, _u32 length, _u32 reserved, payload }
+// with the payload padded to 8 bytes, behind a capture_file_header_t.
+// A segment ends at its file size or at a record of length 0.
+class rx_capture
+{
+public:
+    enum {
+        CAPTURE_RECORD_ALIGN = 8,
+    };
+
+#if defined(_WIN32)
+#pragma pack(1)
+#endif
+    typedef struct _capture_file_header_t {
+        _u8  magic[8];        // "RPLDCAP1"
+        _u32 header_size;     // offset of the first record
+        _u32 segment_index;
+    } __attribute__((packed)) capture_file_header_t;
+
+    typedef struct _capture_record_t {
+        _u64 timestamp_ns;
+        _u32 length;
+        _u32 reserved;
+    } __attribute__((packed)) capture_record_t;
+#if defined(_WIN32)
+#pragma pack()
+#endif
+
+    static const char * Magic() { return "RPLDCAP1"; }
+
+    // returns NULL where capturing is not supported
+    static rx_capture * CreateCapture();
+    static void ReleaseCapture(rx_capture *);
+
+    rx_capture() {}
+    virtual ~rx_capture() {}
+
+    // segments are written to <basepath>_0000.rpcap, <basepath>_0001.rpcap, ...
+    virtual bool open(const char * basepath, size_t segment_size = 0) = 0;
+    virtual void close() = 0;
+
+    // hot path: copies the chunk into the mapped segment, never blocks. The caller
+    // passes the CLOCK_MONOTONIC time it received the chunk at, in microseconds
+    virtual void append(const _u8 * data, size_t size, _u64 timestamp_us) = 0;
+
+    virtual _u64 getCapturedBytes() = 0;
+    virtual _u64 getDroppedBytes() = 0;
+};
+
+}}
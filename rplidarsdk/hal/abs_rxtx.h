@@ -47,7 +47,12 @@ public:
         ANS_DEV_ERR = -2,
     };
 
-    static serial_rxtx * CreateRxTx();
+    enum{
+        RXTX_TYPE_DEFAULT = 0,
+        RXTX_TYPE_IOURING = 1, // Linux only, falls back to the default elsewhere
+    };
+
+    static serial_rxtx * CreateRxTx(_u32 type = RXTX_TYPE_DEFAULT);
     static void ReleaseRxTx( serial_rxtx * );
 
     serial_rxtx():_is_serial_opened(false){}
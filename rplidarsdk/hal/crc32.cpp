@@ -0,0 +1,257 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2019 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; 
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "sdkcommon.h"
+#include "hal/crc32.h"
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define RP_CRC32_HAS_ARMV8
+#if defined(__clang__)
+#define RP_CRC32_TARGET_ARMV8 __attribute__((target("crc")))
+#else
+#define RP_CRC32_TARGET_ARMV8 __attribute__((target("+crc")))
+#endif
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <cpuid.h>
+#define RP_CRC32_HAS_PCLMUL
+#define RP_CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+
+namespace rp{ namespace hal{
+
+namespace {
+
+// The slice-by-8 tables, built by the compiler. t[0] is the classic byte
+// table, t[k][i] is the crc of byte i followed by k zero bytes.
+struct crc32_tables_t {
+    _u32 t[8][256];
+};
+
+constexpr _u32 _crc32Bit(_u32 c)
+{
+    return (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+}
+
+constexpr _u32 _crc32Byte(_u32 c, int bits = 8)
+{
+    return bits ? _crc32Byte(_crc32Bit(c), bits - 1) : c;
+}
+
+constexpr _u32 _crc32Next(_u32 c)
+{
+    return (c >> 8) ^ _crc32Byte(c & 0xFF);
+}
+
+constexpr _u32 _crc32Slice(_u32 i, int slice)
+{
+    return slice ? _crc32Next(_crc32Slice(i, slice - 1)) : _crc32Byte(i);
+}
+
+template <size_t... Is>
+constexpr crc32_tables_t _crc32MakeTables(_static_indices<Is...>)
+{
+    return crc32_tables_t{{
+        { _crc32Slice(Is, 0)... }, { _crc32Slice(Is, 1)... },
+        { _crc32Slice(Is, 2)... }, { _crc32Slice(Is, 3)... },
+        { _crc32Slice(Is, 4)... }, { _crc32Slice(Is, 5)... },
+        { _crc32Slice(Is, 6)... }, { _crc32Slice(Is, 7)... },
+    }};
+}
+
+constexpr crc32_tables_t _crc32Tables = _crc32MakeTables(_make_static_indices<256>::type());
+
+static_assert(_crc32Tables.t[0][1] == 0x77073096, "crc32 table");
+static_assert(_crc32Tables.t[7][255] == _crc32Slice(255, 7), "crc32 slice table");
+
+typedef _u32 (*crc32_kernel_t)(_u32 crc, const _u8 * data, size_t size);
+
+static _u32 _crc32Slice8(_u32 crc, const _u8 * data, size_t size)
+{
+    const _u32 (&t)[8][256] = _crc32Tables.t;
+
+    for (; size >= 8; size -= 8, data += 8) {
+        crc ^= (_u32)data[0] | ((_u32)data[1] << 8) | ((_u32)data[2] << 16) | ((_u32)data[3] << 24);
+        crc = t[7][crc & 0xFF] ^ t[6][(crc >> 8) & 0xFF] ^ t[5][(crc >> 16) & 0xFF] ^ t[4][crc >> 24]
+            ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(RP_CRC32_HAS_ARMV8)
+RP_CRC32_TARGET_ARMV8
+static _u32 _crc32Armv8(_u32 crc, const _u8 * data, size_t size)
+{
+    for (; size >= 8; size -= 8, data += 8) {
+        _u64 word;
+        memcpy(&word, data, 8);
+        crc = __crc32d(crc, word);
+    }
+    while (size--) {
+        crc = __crc32b(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+#if defined(RP_CRC32_HAS_PCLMUL)
+// Carry-less multiplication folding after "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction" (Intel, 2009), with the
+// bit-reflected constants for the 0x04C11DB7 polynomial.
+RP_CRC32_TARGET_PCLMUL
+static _u32 _crc32Pclmul(_u32 crc, const _u8 * data, size_t size)
+{
+    if (size < 64) return _crc32Slice8(crc, data, size);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+    __m128i x5;
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    size -= 64;
+
+    // fold 4 lanes of 128 bits in parallel
+    for (; size >= 64; size -= 64, data += 64) {
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 0x30)));
+    }
+
+    // fold the lanes into one
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    for (; size >= 16; size -= 16, data += 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data)), x5);
+    }
+
+    // 128 -> 64 bits
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x5);
+
+    x5 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x5);
+
+    // Barrett reduction to 32 bits
+    x5 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+    x5 = _mm_clmulepi64_si128(_mm_and_si128(x5, low32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x5);
+
+    crc = (_u32)_mm_extract_epi32(x1, 1);
+    return _crc32Slice8(crc, data, size);
+}
+#endif
+
+static crc32_kernel_t _crc32SelectKernel(const char ** name)
+{
+#if defined(RP_CRC32_HAS_ARMV8)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        *name = "armv8";
+        return _crc32Armv8;
+    }
+#elif defined(RP_CRC32_HAS_PCLMUL)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)) {
+        *name = "pclmul";
+        return _crc32Pclmul;
+    }
+#endif
+    *name = "slice8";
+    return _crc32Slice8;
+}
+
+struct crc32_kernel_info_t {
+    crc32_kernel_t kernel;
+    const char *   name;
+
+    crc32_kernel_info_t() { kernel = _crc32SelectKernel(&name); }
+};
+
+static const crc32_kernel_info_t & _crc32Kernel()
+{
+    // initialized exactly once, even with several threads calling in
+    static const crc32_kernel_info_t info;
+    return info;
+}
+
+}
+
+_u32 Crc32::Update(_u32 crc, const void * data, size_t size)
+{
+    return _crc32Kernel().kernel(crc, (const _u8 *)data, size);
+}
+
+const char * Crc32::KernelName()
+{
+    return _crc32Kernel().name;
+}
+
+}}
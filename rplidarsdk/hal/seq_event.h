@@ -0,0 +1,141 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2019 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; 
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#pragma once
+
+#include "hal/event.h"
+
+#if !defined(_WIN32) && !defined(_MACOS)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace rp{ namespace hal{
+
+// A counter that one thread bumps and other threads wait on to move past a value
+// they have seen. Unlike Event, publish() takes no lock: on linux the counter is
+// a futex word and the wake up syscall is only made while somebody is waiting.
+class SeqEvent
+{
+public:
+    enum
+    {
+        EVENT_OK = Event::EVENT_OK,
+        EVENT_TIMEOUT = Event::EVENT_TIMEOUT,
+        EVENT_FAILED = Event::EVENT_FAILED,
+    };
+
+    SeqEvent()
+        : _seq(0)
+        , _waiters(0)
+    {
+    }
+
+    _u32 sequence() const
+    {
+        return __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+    }
+
+    void publish()
+    {
+        __atomic_add_fetch(&_seq, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&_waiters, __ATOMIC_SEQ_CST) == 0) return;
+#if !defined(_WIN32) && !defined(_MACOS)
+        syscall(SYS_futex, &_seq, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, NULL, NULL, 0);
+#else
+        _evt.set();
+#endif
+    }
+
+    // returns EVENT_OK once sequence() differs from seen
+    unsigned long wait(_u32 seen, unsigned long timeout = 0xFFFFFFFF)
+    {
+        if (sequence() != seen) return EVENT_OK;
+        if (timeout == 0) return EVENT_TIMEOUT;
+
+        __atomic_add_fetch(&_waiters, 1, __ATOMIC_SEQ_CST);
+        unsigned long ans = EVENT_OK;
+#if !defined(_WIN32) && !defined(_MACOS)
+        timespec deadline, now;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (__atomic_load_n(&_seq, __ATOMIC_SEQ_CST) == seen) {
+            timespec remaining, * rel = NULL;
+            if (timeout != 0xFFFFFFFF) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+                remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+                if (remaining.tv_nsec < 0) {
+                    --remaining.tv_sec;
+                    remaining.tv_nsec += 1000000000L;
+                }
+                if (remaining.tv_sec < 0) {
+                    ans = EVENT_TIMEOUT;
+                    break;
+                }
+                rel = &remaining;
+            }
+            // returns at once when _seq has moved on since the check above
+            if (syscall(SYS_futex, &_seq, FUTEX_WAIT_PRIVATE, seen, rel, NULL, 0) == -1
+                && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+                ans = EVENT_FAILED;
+                break;
+            }
+        }
+#else
+        while (__atomic_load_n(&_seq, __ATOMIC_SEQ_CST) == seen) {
+            ans = _evt.wait(timeout);
+            if (ans != EVENT_OK) break;
+        }
+#endif
+        __atomic_sub_fetch(&_waiters, 1, __ATOMIC_SEQ_CST);
+        return ans;
+    }
+
+protected:
+    _u32 _seq;
+    _u32 _waiters;
+#if defined(_WIN32) || defined(_MACOS)
+    Event _evt;
+#endif
+};
+
+}}
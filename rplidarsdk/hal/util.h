@@ -65,3 +65,18 @@ char (*__countof_helper( _CountofType (&_Array)[_SizeOfArray]))[_SizeOfArray];
 #define END_STATIC_CODE( _blockname_ ) \
     }   _instance_##_blockname_;
 
+
+/* compile time index list to expand lookup tables from (std::index_sequence is C++14) */
+#if defined(__cplusplus)
+extern "C++"
+{
+template <size_t... _Indices>
+struct _static_indices {};
+
+template <size_t _Count, size_t... _Indices>
+struct _make_static_indices : _make_static_indices<_Count - 1, _Count - 1, _Indices...> {};
+
+template <size_t... _Indices>
+struct _make_static_indices<0, _Indices...> { typedef _static_indices<_Indices...> type; };
+}
+#endif
@@ -35,18 +35,31 @@
 #include "sdkcommon.h"
 
 #include "hal/abs_rxtx.h"
+#include "hal/abs_capture.h"
+#include "hal/crc32.h"
 #include "hal/thread.h"
 #include "hal/types.h"
 #include "hal/assert.h"
 #include "hal/locker.h"
 #include "hal/socket.h"
 #include "hal/event.h"
+#include "hal/seq_event.h"
+#include "rplidar_scan_queue.h"
 #include "rplidar_driver_impl.h"
 #include "rplidar_driver_serial.h"
 #include "rplidar_driver_TCP.h"
+#include "rplidar_driver_replay.h"
 
 #include <algorithm>
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define RP_SYNC_SCAN_SSE2
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define RP_SYNC_SCAN_NEON
+#endif
+
 #ifndef min
 #define min(a,b)            (((a) < (b)) ? (a) : (b))
 #endif
@@ -81,6 +94,67 @@ static void convert(const rplidar_response_measurement_node_hq_t& from, rplidar_
     to.distance_q2 = from.dist_mm_q2 > _u16(-1) ? _u16(0) : _u16(from.dist_mm_q2);
 }
 
+static inline void _pushNode(RplidarScanSoA & scan, _u16 angle_z_q14, _u32 dist_mm_q2, _u8 quality, _u8 flag)
+{
+    size_t pos = scan.count++;
+    scan.angle_z_q14[pos] = angle_z_q14;
+    scan.dist_mm_q2[pos] = dist_mm_q2;
+    scan.quality[pos] = quality;
+    scan.flag[pos] = flag;
+}
+
+static inline void _packNode(const RplidarScanSoA & scan, size_t pos, rplidar_response_measurement_node_hq_t & to)
+{
+    to.angle_z_q14 = scan.angle_z_q14[pos];
+    to.dist_mm_q2 = scan.dist_mm_q2[pos];
+    to.quality = scan.quality[pos];
+    to.flag = scan.flag[pos];
+}
+
+static inline void _copyNodes(RplidarScanSoA & to, size_t toPos, const RplidarScanSoA & from, size_t fromPos, size_t count)
+{
+    memcpy(to.angle_z_q14 + toPos, from.angle_z_q14 + fromPos, count * sizeof(_u16));
+    memcpy(to.dist_mm_q2 + toPos, from.dist_mm_q2 + fromPos, count * sizeof(_u32));
+    memcpy(to.quality + toPos, from.quality + fromPos, count);
+    memcpy(to.flag + toPos, from.flag + fromPos, count);
+    if (to.timestamp_us && from.timestamp_us) memcpy(to.timestamp_us + toPos, from.timestamp_us + fromPos, count * sizeof(_u64));
+}
+
+// The newest node of a frame is stamped with the frame's arrival time and every node
+// before it one sample duration earlier. The decoders spread the nodes of a capsule
+// evenly over its angle span, so this matches the angles they were given.
+// The arrival time is an estimate and the sample duration nominal, a frame that would
+// reach back to lastUs, the newest stamp handed out so far, is squeezed in after it
+// so the stamps only ever increase.
+static inline void _stampNodes(RplidarScanSoA & scan, _u64 arrivalUs, float usPerSample, _u64 & lastUs)
+{
+    const size_t count = scan.count;
+    if (!count) return;
+    if (arrivalUs < lastUs + count) arrivalUs = lastUs + count;
+
+    const _u64 span = (_u64)((count - 1) * usPerSample + 0.5f);
+    if (span < arrivalUs - lastUs) {
+        for (size_t pos = 0; pos < count; ++pos) {
+            scan.timestamp_us[pos] = arrivalUs - (_u64)((count - 1 - pos) * usPerSample + 0.5f);
+        }
+    } else {
+        const double step = (double)(arrivalUs - lastUs) / count;
+        for (size_t pos = 0; pos < count; ++pos) {
+            scan.timestamp_us[pos] = lastUs + (_u64)((pos + 1) * step);
+        }
+        scan.timestamp_us[count - 1] = arrivalUs;
+    }
+    lastUs = arrivalUs;
+}
+
+// The channel estimates when the bytes it handed out last arrived, ask the clock
+// only where it can't
+static inline _u64 _arrivalUs(ChannelDevice * chanDev)
+{
+    _u64 arrivalUs = chanDev->arrivalUs();
+    return arrivalUs ? arrivalUs : getus();
+}
+
 // Factory Impl
 RPlidarDriver * RPlidarDriver::CreateDriver(_u32 drivertype)
 {
@@ -89,6 +163,11 @@ RPlidarDriver * RPlidarDriver::CreateDriver(_u32 drivertype)
         return new RPlidarDriverSerial();
     case DRIVER_TYPE_TCP:
          return new RPlidarDriverTCP();
+    case DRIVER_TYPE_SERIALPORT_IOURING:
+        // uses raw_serial when io_uring is not available
+        return new RPlidarDriverSerial(rp::hal::serial_rxtx::RXTX_TYPE_IOURING);
+    case DRIVER_TYPE_REPLAY:
+        return new RPlidarDriverReplay();
     default:
         return NULL;
     }
@@ -106,10 +185,18 @@ RPlidarDriverImplCommon::RPlidarDriverImplCommon()
     , _isScanning(false)
     , _isSupportingMotorCtrl(false)
 {
-    _cached_scan_node_hq_count = 0;
-    _cached_scan_node_hq_count_for_interval_retrieve = 0;
+    _syncBufferPos = _syncBufferLen = 0;
     _cached_sampleduration_std = LEGACY_SAMPLE_DURATION;
     _cached_sampleduration_express = LEGACY_SAMPLE_DURATION;
+    _sampleDurationUs = LEGACY_SAMPLE_DURATION;
+    _stdSampleDurationUs = 0;
+    _frameArrivalUs = 0;
+    _syncBufferArrivalUs = 0;
+    _usPerByte = 0;
+    _minScanRpm = DEFAULT_MIN_SCAN_RPM;
+    _maxScanNodes = 0;
+    _sortScratch = NULL;
+    _sortScratchBusy = false;
 }
 
 bool RPlidarDriverImplCommon::isConnected()
@@ -375,6 +462,7 @@ u_result RPlidarDriverImplCommon::_waitScanData(rplidar_response_measurement_nod
         }
         
         nodebuffer[recvNodeCount++] = node;
+        _frameArrivalUs = _arrivalUs(_chanDev);
 
         if (recvNodeCount == count) return RESULT_OK;
     }
@@ -385,224 +473,226 @@ u_result RPlidarDriverImplCommon::_waitScanData(rplidar_response_measurement_nod
 
 u_result RPlidarDriverImplCommon::_waitCapsuledNode(rplidar_response_capsule_measurement_nodes_t & node, _u32 timeout)
 {
-    int  recvPos = 0;
-    _u32 startTs = getms();
-    _u8  recvBuffer[sizeof(rplidar_response_capsule_measurement_nodes_t)];
-    _u8 *nodeBuffer = (_u8*)&node;
-    _u32 waitTime;
+    u_result ans = _waitSyncedFrame((_u8 *)&node, sizeof(node), false, timeout);
+    if (IS_OK(ans) && (node.start_angle_sync_q6 & RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT))
+    {
+        // this is the first capsule frame in logic, discard the previous cached data...
+        _is_previous_capsuledataRdy = false;
+    }
+    return ans;
+}
+
+u_result RPlidarDriverImplCommon::_waitUltraCapsuledNode(rplidar_response_ultra_capsule_measurement_nodes_t & node, _u32 timeout)
+{
+    if (!_isConnected) {
+        return RESULT_OPERATION_FAIL;
+    }
 
+    u_result ans = _waitSyncedFrame((_u8 *)&node, sizeof(node), false, timeout);
+    if (IS_OK(ans) && (node.start_angle_sync_q6 & RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT))
+    {
+        // this is the first capsule frame in logic, discard the previous cached data...
+        _is_previous_capsuledataRdy = false;
+    }
+    return ans;
+}
 
-   while ((waitTime=getms() - startTs) <= timeout) {
-        size_t remainSize = sizeof(rplidar_response_capsule_measurement_nodes_t) - recvPos;
-        size_t recvSize;
+struct RPlidarDriverImplCommon::StandardScanMode
+{
+    typedef struct _frame_t {
+        rplidar_response_measurement_node_t nodes[128];
+        size_t                              count;
+    } frame_t;
+    enum { MAX_FRAME_NODES = 128, DECODES_PREVIOUS = 0 };
 
-        bool ans = _chanDev->waitfordata(remainSize, timeout-waitTime, &recvSize);
-        if(!ans)
-        {
-            return RESULT_OPERATION_TIMEOUT;
+    static u_result wait(RPlidarDriverImplCommon * drv, frame_t & frame)
+    {
+        frame.count = _countof(frame.nodes);
+        u_result ans = drv->_waitScanData(frame.nodes, frame.count);
+        // a timeout still hands out the nodes received so far
+        return (ans == RESULT_OPERATION_TIMEOUT && frame.count) ? RESULT_OK : ans;
+    }
+    static void decode(RPlidarDriverImplCommon * drv, const frame_t & previous, const frame_t & frame, RplidarScanSoA & nodes)
+    {
+        nodes.count = 0;
+        for (size_t pos = 0; pos < frame.count; ++pos) {
+            rplidar_response_measurement_node_hq_t node;
+            convert(frame.nodes[pos], node);
+            _pushNode(nodes, node.angle_z_q14, node.dist_mm_q2, node.quality, node.flag);
         }
-        if (recvSize > remainSize) recvSize = remainSize;
-        
-        recvSize = _chanDev->recvdata(recvBuffer, recvSize);
-        
-        for (size_t pos = 0; pos < recvSize; ++pos) {
-            _u8 currentByte = recvBuffer[pos];
+    }
+};
 
-            switch (recvPos) {
-            case 0: // expect the sync bit 1
-                {
-                    _u8 tmp = (currentByte>>4);
-                    if ( tmp == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 ) {
-                        // pass
-                    } else {
-                        _is_previous_capsuledataRdy = false;
-                        continue;
-                    }
+struct RPlidarDriverImplCommon::CapsuleScanMode
+{
+    typedef rplidar_response_capsule_measurement_nodes_t frame_t;
+    enum { MAX_FRAME_NODES = 32, DECODES_PREVIOUS = 1 };
 
-                }
-                break;
-            case 1: // expect the sync bit 2
-                {
-                    _u8 tmp = (currentByte>>4);
-                    if (tmp == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2) {
-                        // pass
-                    } else {
-                        recvPos = 0;
-                        _is_previous_capsuledataRdy = false;
-                        continue;
-                    }
-                }
-                break;
-            }
-            nodeBuffer[recvPos++] = currentByte;
-            if (recvPos == sizeof(rplidar_response_capsule_measurement_nodes_t)) {
-                // calc the checksum ...
-                _u8 checksum = 0;
-                _u8 recvChecksum = ((node.s_checksum_1 & 0xF) | (node.s_checksum_2<<4));
-                for (size_t cpos = offsetof(rplidar_response_capsule_measurement_nodes_t, start_angle_sync_q6);
-                    cpos < sizeof(rplidar_response_capsule_measurement_nodes_t); ++cpos)
-                {
-                    checksum ^= nodeBuffer[cpos];
-                }
-                if (recvChecksum == checksum)
-                {
-                    // only consider vaild if the checksum matches...
-                    if (node.start_angle_sync_q6 & RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT) 
-                    {
-                        // this is the first capsule frame in logic, discard the previous cached data...
-                        _is_previous_capsuledataRdy = false;
-                        return RESULT_OK;
-                    }
-                    return RESULT_OK;
-                }
-                _is_previous_capsuledataRdy = false;
-                return RESULT_INVALID_DATA;
-            }
-        }
+    static u_result wait(RPlidarDriverImplCommon * drv, frame_t & frame)
+    {
+        return drv->_waitCapsuledNode(frame);
     }
-    _is_previous_capsuledataRdy = false;
-    return RESULT_OPERATION_TIMEOUT;
-}
+    static void decode(RPlidarDriverImplCommon * drv, const frame_t & previous, const frame_t & frame, RplidarScanSoA & nodes)
+    {
+        drv->_capsuleToNormal(previous, frame, nodes);
+    }
+};
 
-u_result RPlidarDriverImplCommon::_waitUltraCapsuledNode(rplidar_response_ultra_capsule_measurement_nodes_t & node, _u32 timeout)
+struct RPlidarDriverImplCommon::DenseCapsuleScanMode
 {
-    if (!_isConnected) {
-        return RESULT_OPERATION_FAIL;
+    typedef rplidar_response_capsule_measurement_nodes_t frame_t;
+    enum { MAX_FRAME_NODES = 40, DECODES_PREVIOUS = 1 };
+
+    static u_result wait(RPlidarDriverImplCommon * drv, frame_t & frame)
+    {
+        return drv->_waitCapsuledNode(frame);
     }
-    
-    int  recvPos = 0;
-    _u32 startTs = getms();
-    _u8  recvBuffer[sizeof(rplidar_response_ultra_capsule_measurement_nodes_t)];
-    _u8 *nodeBuffer = (_u8*)&node;
-    _u32 waitTime;
-    
-    while ((waitTime=getms() - startTs) <= timeout) {
-        size_t remainSize = sizeof(rplidar_response_ultra_capsule_measurement_nodes_t) - recvPos;
-        size_t recvSize;
+    static void decode(RPlidarDriverImplCommon * drv, const frame_t & previous, const frame_t & frame, RplidarScanSoA & nodes)
+    {
+        drv->_dense_capsuleToNormal(previous, frame, nodes);
+    }
+};
 
-        bool ans = _chanDev->waitfordata(remainSize, timeout-waitTime, &recvSize);
-        if(!ans)
-        {
-            return RESULT_OPERATION_TIMEOUT;
-        }
-        if (recvSize > remainSize) recvSize = remainSize;
-        
-        recvSize = _chanDev->recvdata(recvBuffer, recvSize);
-        
-        for (size_t pos = 0; pos < recvSize; ++pos) {
-            _u8 currentByte = recvBuffer[pos];
-            switch (recvPos) {
-            case 0: // expect the sync bit 1
-                {
-                    _u8 tmp = (currentByte>>4);
-                    if ( tmp == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 ) {
-                    // pass
-                    }
-                    else {
-                        _is_previous_capsuledataRdy = false;
-                        continue;
-                    }
-                }    
-            break;
-            case 1: // expect the sync bit 2
-            {
-                _u8 tmp = (currentByte>>4);
-                if (tmp == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2) {
-                    // pass
-                }
-                else {
-                    recvPos = 0;
-                    _is_previous_capsuledataRdy = false;
-                    continue;
-                }
-            }
-            break;
-            }
-            nodeBuffer[recvPos++] = currentByte;
-            if (recvPos == sizeof(rplidar_response_ultra_capsule_measurement_nodes_t)) {
-                // calc the checksum ...
-                _u8 checksum = 0;
-                _u8 recvChecksum = ((node.s_checksum_1 & 0xF) | (node.s_checksum_2 << 4));
-                
-                for (size_t cpos = offsetof(rplidar_response_ultra_capsule_measurement_nodes_t, start_angle_sync_q6);
-                cpos < sizeof(rplidar_response_ultra_capsule_measurement_nodes_t); ++cpos)
-                {
-                    checksum ^= nodeBuffer[cpos];
-                }
-                
-                if (recvChecksum == checksum)
-                {
-                    // only consider vaild if the checksum matches...
-                    if (node.start_angle_sync_q6 & RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT) 
-                    {
-                        // this is the first capsule frame in logic, discard the previous cached data...
-                        _is_previous_capsuledataRdy = false;
-                        return RESULT_OK;
-                    }
-                    return RESULT_OK;
-                }
-                _is_previous_capsuledataRdy = false;
-                return RESULT_INVALID_DATA;
-            }
-        }
+struct RPlidarDriverImplCommon::UltraCapsuleScanMode
+{
+    typedef rplidar_response_ultra_capsule_measurement_nodes_t frame_t;
+    enum { MAX_FRAME_NODES = 96, DECODES_PREVIOUS = 1 };
+
+    static u_result wait(RPlidarDriverImplCommon * drv, frame_t & frame)
+    {
+        return drv->_waitUltraCapsuledNode(frame);
     }
-    _is_previous_capsuledataRdy = false;
-    return RESULT_OPERATION_TIMEOUT;
-}
+    static void decode(RPlidarDriverImplCommon * drv, const frame_t & previous, const frame_t & frame, RplidarScanSoA & nodes)
+    {
+        drv->_ultraCapsuleToNormal(previous, frame, nodes);
+    }
+};
+
+struct RPlidarDriverImplCommon::HqScanMode
+{
+    typedef rplidar_response_hq_capsule_measurement_nodes_t frame_t;
+    enum { MAX_FRAME_NODES = 16, DECODES_PREVIOUS = 0 };
+
+    static u_result wait(RPlidarDriverImplCommon * drv, frame_t & frame)
+    {
+        return drv->_waitHqNode(frame);
+    }
+    static void decode(RPlidarDriverImplCommon * drv, const frame_t & previous, const frame_t & frame, RplidarScanSoA & nodes)
+    {
+        drv->_HqToNormal(frame, nodes);
+    }
+};
 
+template <class TScanMode>
 u_result RPlidarDriverImplCommon::_cacheScanData()
 {
-    rplidar_response_measurement_node_t      local_buf[128];
-    size_t                                   count = 128;
-    rplidar_response_measurement_node_hq_t   local_scan[MAX_SCAN_NODES];
+    // the capsule decoders interpolate between a frame and its successor, so the
+    // last frame is kept in place and the next one is received into the other slot
+    typename TScanMode::frame_t              frames[2];
+    _u64                                     arrivalUs[2] = {0, 0};
+    _u64                                     lastStampUs = 0;
+    size_t                                   current = 0;
+    RplidarScanSoABuffer<TScanMode::MAX_FRAME_NODES> local_buf;
+    RplidarScanSoA *                         local_scan = &_scanQueue.fillBuffer();
     size_t                                   scan_count = 0;
     u_result                                 ans;
-    memset(local_scan, 0, sizeof(local_scan));
 
-    _waitScanData(local_buf, count); // // always discard the first data since it may be incomplete
+    _syncBufferPos = _syncBufferLen = 0;
+    _is_previous_capsuledataRdy = false;
+    _is_previous_HqdataRdy = false;
+    _scanGrid.restart();
+    _rotation.restart();
+    TScanMode::wait(this, frames[current]); // always discard the first data since it may be incomplete
+    _is_previous_capsuledataRdy = false;
 
     while(_isScanning)
     {
-        if (IS_FAIL(ans=_waitScanData(local_buf, count))) {
-            if (ans != RESULT_OPERATION_TIMEOUT) {
+        if (IS_FAIL(ans = TScanMode::wait(this, frames[current]))) {
+            if (ans != RESULT_OPERATION_TIMEOUT && ans != RESULT_INVALID_DATA) {
                 _isScanning = false;
                 return RESULT_OPERATION_FAIL;
+            } else {
+                // current data is invalid, do not use it.
+                continue;
             }
         }
-        
-        for (size_t pos = 0; pos < count; ++pos)
+
+        arrivalUs[current] = _frameArrivalUs;
+
+        // the capsule modes decode the nodes carried by the previous frame
+        TScanMode::decode(this, frames[current ^ 1], frames[current], local_buf);
+        _stampNodes(local_buf, arrivalUs[TScanMode::DECODES_PREVIOUS ? current ^ 1 : current], _sampleDurationUs, lastStampUs);
+        if (_scanGrid.bins()) _scanGrid.accumulate(local_buf);
+        _rotation.update(local_buf);
+        current ^= 1;
+
+        const size_t count = local_buf.count;
+        size_t pos = 0;
+        while (pos < count)
         {
-            if (local_buf[pos].sync_quality & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)
+            if (local_buf.flag[pos] & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)
             {
                 // only publish the data when it contains a full 360 degree scan 
                 
-                if ((local_scan[0].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) {
-                    _lock.lock();
-                    memcpy(_cached_scan_node_hq_buf, local_scan, scan_count*sizeof(rplidar_response_measurement_node_hq_t));
-                    _cached_scan_node_hq_count = scan_count;
-                    _dataEvt.set();
-                    _lock.unlock();
+                if (scan_count && (local_scan->flag[0] & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) {
+                    local_scan->count = scan_count;
+                    _scanQueue.publish();
+                    local_scan = &_scanQueue.fillBuffer();
                 }
                 scan_count = 0;
             }
 
-            rplidar_response_measurement_node_hq_t nodeHq;
-            convert(local_buf[pos], nodeHq);
-            local_scan[scan_count++] = nodeHq;
-            if (scan_count == _countof(local_scan)) scan_count-=1; // prevent overflow
+            // append the run up to the next sync node in one go
+            size_t end = pos + 1;
+            while (end < count && !(local_buf.flag[end] & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) ++end;
 
-            //for interval retrieve
-            {
-                rp::hal::AutoLocker l(_lock);
-                _cached_scan_node_hq_buf_for_interval_retrieve[_cached_scan_node_hq_count_for_interval_retrieve++] = nodeHq;
-                if(_cached_scan_node_hq_count_for_interval_retrieve == _countof(_cached_scan_node_hq_buf_for_interval_retrieve)) _cached_scan_node_hq_count_for_interval_retrieve-=1; // prevent overflow
+            size_t room = local_scan->capacity - scan_count;
+            if (end - pos < room) {
+                _copyNodes(*local_scan, scan_count, local_buf, pos, end - pos);
+                scan_count += end - pos;
+            } else {
+                // prevent overflow, the last slot keeps the latest node
+                _copyNodes(*local_scan, scan_count, local_buf, pos, room - 1);
+                scan_count = local_scan->capacity - 1;
+                _copyNodes(*local_scan, scan_count, local_buf, end - 1, 1);
             }
+            pos = end;
         }
+
+        //for interval retrieve, published once per frame
+        if (count) _intervalRing.push(local_buf);
     }
     _isScanning = false;
     return RESULT_OK;
 }
 
+// The standard scan mode's sample duration, asked from the device on the first scan
+// start of a connection only. With the config protocol the mode is found by its answer
+// type, the mode ids are not the scan commands.
+float RPlidarDriverImplCommon::_standardSampleDuration()
+{
+    if (_stdSampleDurationUs > 0) return _stdSampleDurationUs;
+
+    float sampleDuration = _cached_sampleduration_std;
+    bool ifSupportLidarConf = false;
+    if (IS_OK(checkSupportConfigCommands(ifSupportLidarConf)) && ifSupportLidarConf) {
+        std::vector<RplidarScanMode> modes;
+        if (IS_OK(getAllSupportedScanModes(modes))) {
+            for (size_t i = 0; i < modes.size(); ++i) {
+                if (modes[i].ans_type == RPLIDAR_ANS_TYPE_MEASUREMENT) {
+                    sampleDuration = modes[i].us_per_sample;
+                    break;
+                }
+            }
+        }
+    } else {
+        rplidar_response_sample_rate_t sampleRate;
+        if (IS_OK(getSampleDuration_uS(sampleRate))) sampleDuration = sampleRate.std_sample_duration_us;
+    }
+    _stdSampleDurationUs = sampleDuration;
+    return sampleDuration;
+}
+
 u_result RPlidarDriverImplCommon::startScanNormal(bool force,  _u32 timeout)
 {
     u_result ans;
@@ -611,6 +701,10 @@ u_result RPlidarDriverImplCommon::startScanNormal(bool force,  _u32 timeout)
 
     stop(); //force the previous operation to stop
 
+    // the cache thread spaces the node timestamps by the sample duration
+    _sampleDurationUs = _standardSampleDuration();
+    _sizeScanBuffers();
+
     {
         rp::hal::AutoLocker l(_lock);
 
@@ -635,7 +729,7 @@ u_result RPlidarDriverImplCommon::startScanNormal(bool force,  _u32 timeout)
         }
 
         _isScanning = true;
-        _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData);
+        _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData<StandardScanMode>);
         if (_cachethread.getHandle() == 0) {
             return RESULT_OPERATION_FAIL;
         }
@@ -665,139 +759,13 @@ u_result RPlidarDriverImplCommon::checkExpressScanSupported(bool & support, _u32
     return RESULT_OK;
 }
 
-u_result RPlidarDriverImplCommon::_cacheCapsuledScanData()
-{
-    rplidar_response_capsule_measurement_nodes_t    capsule_node;
-    rplidar_response_measurement_node_hq_t   local_buf[128];
-    size_t                                   count = 128;
-    rplidar_response_measurement_node_hq_t   local_scan[MAX_SCAN_NODES];
-    size_t                                   scan_count = 0;
-    u_result                                 ans;
-    memset(local_scan, 0, sizeof(local_scan));
-
-    _waitCapsuledNode(capsule_node); // // always discard the first data since it may be incomplete
-
-    
-    
-
-    while(_isScanning)
-    {
-        if (IS_FAIL(ans=_waitCapsuledNode(capsule_node))) {
-            if (ans != RESULT_OPERATION_TIMEOUT && ans != RESULT_INVALID_DATA) {
-                _isScanning = false;
-                return RESULT_OPERATION_FAIL;
-            } else {
-                // current data is invalid, do not use it.
-                continue;
-            }
-        }
-        switch (_cached_express_flag) 
-        {
-        case 0:
-            _capsuleToNormal(capsule_node, local_buf, count);
-            break;
-        case 1:
-            _dense_capsuleToNormal(capsule_node, local_buf, count);
-            break;
-        }
-        //
-        
-        for (size_t pos = 0; pos < count; ++pos)
-        {
-            if (local_buf[pos].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)
-            {
-                // only publish the data when it contains a full 360 degree scan 
-                
-                if ((local_scan[0].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) {
-                    _lock.lock();
-                    memcpy(_cached_scan_node_hq_buf, local_scan, scan_count*sizeof(rplidar_response_measurement_node_hq_t));
-                    _cached_scan_node_hq_count = scan_count;
-                    _dataEvt.set();
-                    _lock.unlock();
-                }
-                scan_count = 0;
-            }
-            local_scan[scan_count++] = local_buf[pos];
-            if (scan_count == _countof(local_scan)) scan_count-=1; // prevent overflow
-
-            //for interval retrieve
-            {
-                rp::hal::AutoLocker l(_lock);
-                _cached_scan_node_hq_buf_for_interval_retrieve[_cached_scan_node_hq_count_for_interval_retrieve++] = local_buf[pos];
-                if(_cached_scan_node_hq_count_for_interval_retrieve == _countof(_cached_scan_node_hq_buf_for_interval_retrieve)) _cached_scan_node_hq_count_for_interval_retrieve-=1; // prevent overflow
-            }
-        }
-    }
-    _isScanning = false;
-
-    return RESULT_OK;
-}
-
-u_result RPlidarDriverImplCommon::_cacheUltraCapsuledScanData()
-{
-    rplidar_response_ultra_capsule_measurement_nodes_t    ultra_capsule_node;
-    rplidar_response_measurement_node_hq_t   local_buf[128];
-    size_t                                   count = 128;
-    rplidar_response_measurement_node_hq_t   local_scan[MAX_SCAN_NODES];
-    size_t                                   scan_count = 0;
-    u_result                                 ans;
-    memset(local_scan, 0, sizeof(local_scan));
-
-    _waitUltraCapsuledNode(ultra_capsule_node);
-    
-    while(_isScanning)
-    {
-        if (IS_FAIL(ans=_waitUltraCapsuledNode(ultra_capsule_node))) {
-            if (ans != RESULT_OPERATION_TIMEOUT && ans != RESULT_INVALID_DATA) {
-                _isScanning = false;
-                return RESULT_OPERATION_FAIL;
-            } else {
-                // current data is invalid, do not use it.
-                continue;
-            }
-        }
-        
-        _ultraCapsuleToNormal(ultra_capsule_node, local_buf, count);
-        
-        for (size_t pos = 0; pos < count; ++pos)
-        {
-            if (local_buf[pos].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)
-            {
-                // only publish the data when it contains a full 360 degree scan 
-                
-                if ((local_scan[0].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) {
-                    _lock.lock();
-                    memcpy(_cached_scan_node_hq_buf, local_scan, scan_count*sizeof(rplidar_response_measurement_node_hq_t));
-                    _cached_scan_node_hq_count = scan_count;
-                    _dataEvt.set();
-                    _lock.unlock();
-                }
-                scan_count = 0;
-            }
-            local_scan[scan_count++] = local_buf[pos];
-            if (scan_count == _countof(local_scan)) scan_count-=1; // prevent overflow
-
-            //for interval retrieve
-            {
-                rp::hal::AutoLocker l(_lock);
-                _cached_scan_node_hq_buf_for_interval_retrieve[_cached_scan_node_hq_count_for_interval_retrieve++] = local_buf[pos];
-                if(_cached_scan_node_hq_count_for_interval_retrieve == _countof(_cached_scan_node_hq_buf_for_interval_retrieve)) _cached_scan_node_hq_count_for_interval_retrieve-=1; // prevent overflow
-            }
-        }
-    }
-    
-    _isScanning = false;
-
-    return RESULT_OK;
-}
-
-void     RPlidarDriverImplCommon::_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount)
+void     RPlidarDriverImplCommon::_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & previous, const rplidar_response_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes)
 {
-    nodeCount = 0;
+    nodes.count = 0;
     if (_is_previous_capsuledataRdy) {
         int diffAngle_q8;
         int currentStartAngle_q8 = ((capsule.start_angle_sync_q6 & 0x7FFF)<< 2);
-        int prevStartAngle_q8 = ((_cached_previous_capsuledata.start_angle_sync_q6 & 0x7FFF) << 2);
+        int prevStartAngle_q8 = ((previous.start_angle_sync_q6 & 0x7FFF) << 2);
 
         diffAngle_q8 = (currentStartAngle_q8) - (prevStartAngle_q8);
         if (prevStartAngle_q8 >  currentStartAngle_q8) {
@@ -806,17 +774,17 @@ void     RPlidarDriverImplCommon::_capsuleToNormal(const rplidar_response_capsul
 
         int angleInc_q16 = (diffAngle_q8 << 3);
         int currentAngle_raw_q16 = (prevStartAngle_q8 << 8);
-        for (size_t pos = 0; pos < _countof(_cached_previous_capsuledata.cabins); ++pos)
+        for (size_t pos = 0; pos < _countof(previous.cabins); ++pos)
         {
             int dist_q2[2];
             int angle_q6[2];
             int syncBit[2];
 
-            dist_q2[0] = (_cached_previous_capsuledata.cabins[pos].distance_angle_1 & 0xFFFC);
-            dist_q2[1] = (_cached_previous_capsuledata.cabins[pos].distance_angle_2 & 0xFFFC);
+            dist_q2[0] = (previous.cabins[pos].distance_angle_1 & 0xFFFC);
+            dist_q2[1] = (previous.cabins[pos].distance_angle_2 & 0xFFFC);
 
-            int angle_offset1_q3 = ( (_cached_previous_capsuledata.cabins[pos].offset_angles_q3 & 0xF) | ((_cached_previous_capsuledata.cabins[pos].distance_angle_1 & 0x3)<<4));
-            int angle_offset2_q3 = ( (_cached_previous_capsuledata.cabins[pos].offset_angles_q3 >> 4) | ((_cached_previous_capsuledata.cabins[pos].distance_angle_2 & 0x3)<<4));
+            int angle_offset1_q3 = ( (previous.cabins[pos].offset_angles_q3 & 0xF) | ((previous.cabins[pos].distance_angle_1 & 0x3)<<4));
+            int angle_offset2_q3 = ( (previous.cabins[pos].offset_angles_q3 >> 4) | ((previous.cabins[pos].distance_angle_2 & 0x3)<<4));
 
             angle_q6[0] = ((currentAngle_raw_q16 - (angle_offset1_q3<<13))>>10);
             syncBit[0] =  (( (currentAngle_raw_q16 + angleInc_q16) % (360<<16)) < angleInc_q16 )?1:0;
@@ -832,31 +800,28 @@ void     RPlidarDriverImplCommon::_capsuleToNormal(const rplidar_response_capsul
                 if (angle_q6[cpos] < 0) angle_q6[cpos] += (360<<6);
                 if (angle_q6[cpos] >= (360<<6)) angle_q6[cpos] -= (360<<6);
 
-                rplidar_response_measurement_node_hq_t node;
-
-                node.angle_z_q14 = _u16((angle_q6[cpos] << 8) / 90);
-                node.flag = (syncBit[cpos] | ((!syncBit[cpos]) << 1));
-                node.quality = dist_q2[cpos] ? (0x2f << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0;
-                node.dist_mm_q2 = dist_q2[cpos];
-
-                nodebuffer[nodeCount++] = node;
+                _pushNode(nodes,
+                    _u16((angle_q6[cpos] << 8) / 90),
+                    dist_q2[cpos],
+                    dist_q2[cpos] ? (0x2f << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0,
+                    (syncBit[cpos] | ((!syncBit[cpos]) << 1)));
              }
 
         }
     }
 
-    _cached_previous_capsuledata = capsule;
     _is_previous_capsuledataRdy = true;
 }
 
-void     RPlidarDriverImplCommon::_dense_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount)
+void     RPlidarDriverImplCommon::_dense_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & previous, const rplidar_response_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes)
 {
     const rplidar_response_dense_capsule_measurement_nodes_t *dense_capsule = reinterpret_cast<const rplidar_response_dense_capsule_measurement_nodes_t*>(&capsule);
-    nodeCount = 0;
+    const rplidar_response_dense_capsule_measurement_nodes_t *dense_previous = reinterpret_cast<const rplidar_response_dense_capsule_measurement_nodes_t*>(&previous);
+    nodes.count = 0;
     if (_is_previous_capsuledataRdy) {
         int diffAngle_q8;
         int currentStartAngle_q8 = ((dense_capsule->start_angle_sync_q6 & 0x7FFF) << 2);
-        int prevStartAngle_q8 = ((_cached_previous_dense_capsuledata.start_angle_sync_q6 & 0x7FFF) << 2);
+        int prevStartAngle_q8 = ((dense_previous->start_angle_sync_q6 & 0x7FFF) << 2);
 
         diffAngle_q8 = (currentStartAngle_q8)-(prevStartAngle_q8);
         if (prevStartAngle_q8 >  currentStartAngle_q8) {
@@ -865,12 +830,12 @@ void     RPlidarDriverImplCommon::_dense_capsuleToNormal(const rplidar_response_
 
         int angleInc_q16 = (diffAngle_q8 << 8)/40;
         int currentAngle_raw_q16 = (prevStartAngle_q8 << 8);
-        for (size_t pos = 0; pos < _countof(_cached_previous_dense_capsuledata.cabins); ++pos)
+        for (size_t pos = 0; pos < _countof(dense_previous->cabins); ++pos)
         {
             int dist_q2;
             int angle_q6;
             int syncBit;
-            const int dist = static_cast<const int>(_cached_previous_dense_capsuledata.cabins[pos].distance);
+            const int dist = static_cast<const int>(dense_previous->cabins[pos].distance);
             dist_q2 = dist << 2;
             angle_q6 = (currentAngle_raw_q16 >> 10);
             syncBit = (((currentAngle_raw_q16 + angleInc_q16) % (360 << 16)) < angleInc_q16) ? 1 : 0;
@@ -881,276 +846,271 @@ void     RPlidarDriverImplCommon::_dense_capsuleToNormal(const rplidar_response_
 
             
 
-            rplidar_response_measurement_node_hq_t node;
-
-            node.angle_z_q14 = _u16((angle_q6 << 8) / 90);
-            node.flag = (syncBit | ((!syncBit) << 1));
-            node.quality = dist_q2 ? (0x2f << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0;
-            node.dist_mm_q2 = dist_q2;
-
-            nodebuffer[nodeCount++] = node;
+            _pushNode(nodes,
+                _u16((angle_q6 << 8) / 90),
+                dist_q2,
+                dist_q2 ? (0x2f << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0,
+                (syncBit | ((!syncBit) << 1)));
             
 
         }
     }
 
-    _cached_previous_dense_capsuledata = *dense_capsule;
     _is_previous_capsuledataRdy = true;
 }
 
-u_result RPlidarDriverImplCommon::_cacheHqScanData()
+//crc32 of the frame, zero padded to a multiple of 4 bytes like the device does
+static _u32 _crc32(const _u8 *ptr, _u32 len)
 {
-    rplidar_response_hq_capsule_measurement_nodes_t    hq_node;
-    rplidar_response_measurement_node_hq_t   local_buf[128];
-    size_t                                   count = 128;
-    rplidar_response_measurement_node_hq_t   local_scan[MAX_SCAN_NODES];
-    size_t                                   scan_count = 0;
-    u_result                                 ans;
-    memset(local_scan, 0, sizeof(local_scan));
-    _waitHqNode(hq_node);
-    while (_isScanning) {
-        if (IS_FAIL(ans = _waitHqNode(hq_node))) {
-            if (ans != RESULT_OPERATION_TIMEOUT && ans != RESULT_INVALID_DATA) {
-                _isScanning = false;
-                return RESULT_OPERATION_FAIL;
-            }
-            else {
-				// current data is invalid, do not use it.
-				continue;
-            }
-        }
-
-        _HqToNormal(hq_node, local_buf, count);
-        for (size_t pos = 0; pos < count; ++pos)
-        {
-            if (local_buf[pos].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)
-            {
-				// only publish the data when it contains a full 360 degree scan 
-                if ((local_scan[0].flag & RPLIDAR_RESP_MEASUREMENT_SYNCBIT)) {
-                    _lock.lock();
-                    memcpy(_cached_scan_node_hq_buf, local_scan, scan_count * sizeof(rplidar_response_measurement_node_hq_t));
-                    _cached_scan_node_hq_count = scan_count;
-                    _dataEvt.set();
-                    _lock.unlock();
-                }
-                scan_count = 0;
-            }
-            local_scan[scan_count++] = local_buf[pos];
-            if (scan_count == _countof(local_scan)) scan_count -= 1; // prevent overflow
-																	 //for interval retrieve
-            {
-                rp::hal::AutoLocker l(_lock);
-                _cached_scan_node_hq_buf_for_interval_retrieve[_cached_scan_node_hq_count_for_interval_retrieve++] = local_buf[pos];
-                if (_cached_scan_node_hq_count_for_interval_retrieve == _countof(_cached_scan_node_hq_buf_for_interval_retrieve)) _cached_scan_node_hq_count_for_interval_retrieve -= 1; // prevent overflow
-            }
-        }
-
-    }
-    return RESULT_OK;
+    static const _u8 padding[4] = {0, 0, 0, 0};
+    _u32 crc = rp::hal::Crc32::Update(rp::hal::Crc32::CRC32_INIT, ptr, len);
+    crc = rp::hal::Crc32::Update(crc, padding, (4 - len) & 0x3);
+    return crc ^ 0xFFFFFFFF;
 }
 
-//CRC calculate
-static _u32 table[256];//crc32_table
+//*******************************************frame sync********************************//
 
-//reflect
-static _u32 _bitrev(_u32 input, _u16 bw)
+// Returns the offset of the first possible capsule start: a byte carrying the
+// RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 nibble followed by one carrying SYNC_2.
+// A SYNC_1 byte at the very end counts as a candidate since its successor is
+// still on the way. Returns size if there is none.
+static size_t _findCapsuleSync(const _u8 * data, size_t size)
 {
-    _u16 i;
-    _u32 var;
-    var = 0;
-    for (i = 0; i<bw; i++){
-        if (input & 0x01)
-        {
-            var |= 1 << (bw - 1 - i);
-        }
-        input >>= 1;
+    size_t pos = 0;
+#if defined(RP_SYNC_SCAN_SSE2)
+    const __m128i nibbleMask = _mm_set1_epi8((char)0xF0);
+    const __m128i sync1 = _mm_set1_epi8((char)(RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 << 4));
+    const __m128i sync2 = _mm_set1_epi8((char)(RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2 << 4));
+
+    for (; pos + 17 <= size; pos += 16) {
+        __m128i cur  = _mm_loadu_si128((const __m128i *)(data + pos));
+        __m128i next = _mm_loadu_si128((const __m128i *)(data + pos + 1));
+        __m128i hit  = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(cur, nibbleMask), sync1),
+                                     _mm_cmpeq_epi8(_mm_and_si128(next, nibbleMask), sync2));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return pos + __builtin_ctz(mask);
     }
-    return var;
-}
+#elif defined(RP_SYNC_SCAN_NEON)
+    const uint8x16_t nibbleMask = vdupq_n_u8(0xF0);
+    const uint8x16_t sync1 = vdupq_n_u8(RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 << 4);
+    const uint8x16_t sync2 = vdupq_n_u8(RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2 << 4);
 
-// crc32_table init
-static void _crc32_init(_u32 poly)
-{
-    _u16 i;
-    _u16 j;
-    _u32 c;
-    
-    poly = _bitrev(poly, 32);
-    for (i = 0; i<256; i++){
-        c = i;
-        for (j = 0; j<8; j++){
-            if (c & 1)
-                c = poly ^ (c >> 1);
-            else
-                c = c >> 1;
-        }
-        table[i] = c;
+    for (; pos + 17 <= size; pos += 16) {
+        uint8x16_t cur  = vld1q_u8(data + pos);
+        uint8x16_t next = vld1q_u8(data + pos + 1);
+        uint8x16_t hit  = vandq_u8(vceqq_u8(vandq_u8(cur, nibbleMask), sync1),
+                                   vceqq_u8(vandq_u8(next, nibbleMask), sync2));
+        // narrow to 4 bits per lane, there is no movemask on NEON
+        _u64 mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) return pos + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; pos + 1 < size; ++pos) {
+        if ((data[pos] >> 4) == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 &&
+            (data[pos + 1] >> 4) == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2) return pos;
     }
+    if (pos < size && (data[pos] >> 4) == RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1) return pos;
+    return size;
 }
 
-static _u32 _crc32cal(_u32 crc, void* input, _u16 len)
+// Returns the offset of the first RPLIDAR_RESP_MEASUREMENT_HQ_SYNC byte or size
+static size_t _findHqSync(const _u8 * data, size_t size)
 {
-    _u16 i;
-    _u8 index;
-    _u8* pch;
-    pch = (unsigned char*)input;
-    _u8 leftBytes = 4 - len & 0x3;
-
-    for (i = 0; i<len; i++){
-        index = (unsigned char)(crc^*pch);
-        crc = (crc >> 8) ^ table[index];
-        pch++;
-    }
+    // memchr is vectorized by the C library already
+    const _u8 * found = (const _u8 *)memchr(data, RPLIDAR_RESP_MEASUREMENT_HQ_SYNC, size);
+    return found ? (size_t)(found - data) : size;
+}
 
-    for (i = 0; i < leftBytes; i++) {//zero padding
-        index = (unsigned char)(crc^0);
-        crc = (crc >> 8) ^ table[index];
+static bool _checkCapsuleFrame(const _u8 * frame, size_t frameSize)
+{
+    // the capsule and the ultra capsule share the sync and checksum layout
+    _u8 checksum = 0;
+    _u8 recvChecksum = ((frame[0] & 0xF) | (frame[1] << 4));
+    for (size_t cpos = offsetof(rplidar_response_capsule_measurement_nodes_t, start_angle_sync_q6);
+        cpos < frameSize; ++cpos)
+    {
+        checksum ^= frame[cpos];
     }
-    return crc^0xffffffff;
+    return recvChecksum == checksum;
 }
 
-//crc32cal
-static u_result _crc32(_u8 *ptr, _u32 len) {
-	static _u8 tmp;
-	if (tmp != 1) {
-		_crc32_init(0x4C11DB7);
-		tmp = 1;
-	}
-	
-	return _crc32cal(0xFFFFFFFF, ptr,len);
+static bool _checkHqFrame(const _u8 * frame, size_t frameSize)
+{
+    _u32 recvCrc;
+    memcpy(&recvCrc, frame + frameSize - 4, 4);
+    return _crc32(frame, frameSize - 4) == recvCrc;
 }
 
-u_result RPlidarDriverImplCommon::_waitHqNode(rplidar_response_hq_capsule_measurement_nodes_t & node, _u32 timeout)
+u_result RPlidarDriverImplCommon::_waitSyncedFrame(_u8 * frame, size_t frameSize, bool isHqFrame, _u32 timeout)
 {
-    if (!_isConnected) {
-        return RESULT_OPERATION_FAIL;
-    }
-
-    int  recvPos = 0;
+    bool & previousRdy = isHqFrame ? _is_previous_HqdataRdy : _is_previous_capsuledataRdy;
     _u32 startTs = getms();
-    _u8  recvBuffer[sizeof(rplidar_response_hq_capsule_measurement_nodes_t)];
-    _u8 *nodeBuffer = (_u8*)&node;
     _u32 waitTime;
-    
-    while ((waitTime=getms() - startTs) <= timeout) {
-        size_t remainSize = sizeof(rplidar_response_hq_capsule_measurement_nodes_t) - recvPos;
-        size_t recvSize;
-        
-        bool ans = _chanDev->waitfordata(remainSize, timeout-waitTime, &recvSize);
-        if(!ans)
-        {
-            return RESULT_OPERATION_TIMEOUT;
-        }
-        if (recvSize > remainSize) recvSize = remainSize;
-        
-        recvSize = _chanDev->recvdata(recvBuffer, recvSize);
-    
-        for (size_t pos = 0; pos < recvSize; ++pos) {
-            _u8 currentByte = recvBuffer[pos];
-            switch (recvPos) {
-            case 0: // expect the sync byte
-                {
-                    _u8 tmp = (currentByte);
-                    if ( tmp == RPLIDAR_RESP_MEASUREMENT_HQ_SYNC ) {
-                    // pass
-                    }
-                    else {
-                        recvPos = 0;
-                        _is_previous_HqdataRdy = false;
-                        continue;
-                    }
-                }
-           break;
-           case sizeof(rplidar_response_hq_capsule_measurement_nodes_t) - 1 - 4: 
-            {
 
+    assert(frameSize <= sizeof(_syncBuffer));
+
+    while ((waitTime = getms() - startTs) <= timeout) {
+        // skip everything in front of the next frame candidate
+        const _u8 * data = _syncBuffer + _syncBufferPos;
+        size_t buffered = _syncBufferLen - _syncBufferPos;
+        size_t syncPos = isHqFrame ? _findHqSync(data, buffered) : _findCapsuleSync(data, buffered);
+        if (syncPos) {
+            _syncBufferPos += syncPos;
+            buffered -= syncPos;
+            data += syncPos;
+            previousRdy = false;
+        }
+
+        if (buffered >= frameSize) {
+            if (isHqFrame ? _checkHqFrame(data, frameSize) : _checkCapsuleFrame(data, frameSize)) {
+                memcpy(frame, data, frameSize);
+                _syncBufferPos += frameSize;
+                // the bytes still buffered behind the frame arrived after it
+                _frameArrivalUs = _syncBufferArrivalUs - (_u64)((_syncBufferLen - _syncBufferPos) * _usPerByte + 0.5f);
+                return RESULT_OK;
             }
-           break;
-           case sizeof(rplidar_response_hq_capsule_measurement_nodes_t) - 1: 
-            {				
+            // a damaged frame or a sync pattern inside the payload, the real
+            // frame start can only be further on in the bytes we already have
+            _syncBufferPos += 1;
+            previousRdy = false;
+            return RESULT_INVALID_DATA;
+        }
 
-            }
-           break;
-           }
-           nodeBuffer[recvPos++] = currentByte;
-           if (recvPos == sizeof(rplidar_response_hq_capsule_measurement_nodes_t)) {
-                _u32 crcCalc2 = _crc32(nodeBuffer, sizeof(rplidar_response_hq_capsule_measurement_nodes_t) - 4);
-
-                if(crcCalc2 == node.crc32){
-                    _is_previous_HqdataRdy = true;
-                    return RESULT_OK;
-                }
-                else {
-                    _is_previous_HqdataRdy = false;
-                    return RESULT_INVALID_DATA;
-                }
+        size_t recvSize;
+        if (!_chanDev->waitfordata(frameSize - buffered, timeout - waitTime, &recvSize)) {
+            previousRdy = false;
+            return RESULT_OPERATION_TIMEOUT;
+        }
 
-            }
+        if (_syncBufferPos) {
+            memmove(_syncBuffer, _syncBuffer + _syncBufferPos, buffered);
+            _syncBufferPos = 0;
+            _syncBufferLen = buffered;
         }
+        if (recvSize > sizeof(_syncBuffer) - buffered) recvSize = sizeof(_syncBuffer) - buffered;
+        _syncBufferLen += _chanDev->recvdata(_syncBuffer + _syncBufferLen, recvSize);
+        _syncBufferArrivalUs = _arrivalUs(_chanDev);
     }
-    _is_previous_HqdataRdy = false;
+    previousRdy = false;
     return RESULT_OPERATION_TIMEOUT;
 }
 
-void RPlidarDriverImplCommon::_HqToNormal(const rplidar_response_hq_capsule_measurement_nodes_t & node_hq, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount) 
+u_result RPlidarDriverImplCommon::_waitHqNode(rplidar_response_hq_capsule_measurement_nodes_t & node, _u32 timeout)
+{
+    if (!_isConnected) {
+        return RESULT_OPERATION_FAIL;
+    }
+
+    u_result ans = _waitSyncedFrame((_u8 *)&node, sizeof(node), true, timeout);
+    if (IS_OK(ans)) _is_previous_HqdataRdy = true;
+    return ans;
+}
+
+void RPlidarDriverImplCommon::_HqToNormal(const rplidar_response_hq_capsule_measurement_nodes_t & node_hq, RplidarScanSoA & nodes) 
 {
-    nodeCount = 0;
+    nodes.count = 0;
     if (_is_previous_HqdataRdy) {
-        for (size_t pos = 0; pos < _countof(_cached_previous_Hqdata.node_hq); ++pos)
+        for (size_t pos = 0; pos < _countof(node_hq.node_hq); ++pos)
         {
-            nodebuffer[nodeCount++] = node_hq.node_hq[pos];
+            const rplidar_response_measurement_node_hq_t & node = node_hq.node_hq[pos];
+            _pushNode(nodes, node.angle_z_q14, node.dist_mm_q2, node.quality, node.flag);
         }	
     }
-    _cached_previous_Hqdata = node_hq;
     _is_previous_HqdataRdy = true;
 
 }
 //*******************************************HQ support********************************//
 
-static _u32 _varbitscale_decode(_u32 scaled, _u32 & scaleLevel)
+// Var bit scale decoding of the 12 bit major distance, see RPLIDAR_VARBITSCALE_*:
+// 0..511 are stored as is, values from each X*_DEST_VAL on are scaled by 2, 4, 8
+// and 16 on top of X*_SRC_BIT. All 4096 results are tabulated by the compiler.
+typedef struct _varbitscale_entry_t {
+    _u16 value;
+    _u16 scaleLevel;
+} varbitscale_entry_t;
+
+typedef struct _varbitscale_lut_t {
+    varbitscale_entry_t entry[16][256];
+} varbitscale_lut_t;
+
+constexpr varbitscale_entry_t _varbitscale_level(_u32 scaled, _u32 destVal, _u32 srcBit, _u16 level)
 {
-    static const _u32 VBS_SCALED_BASE[] = {
-        RPLIDAR_VARBITSCALE_X16_DEST_VAL,
-        RPLIDAR_VARBITSCALE_X8_DEST_VAL,
-        RPLIDAR_VARBITSCALE_X4_DEST_VAL,
-        RPLIDAR_VARBITSCALE_X2_DEST_VAL,
-        0,
-    };
+    return varbitscale_entry_t{ _u16((0x1 << srcBit) + ((scaled - destVal) << level)), level };
+}
 
-    static const _u32 VBS_SCALED_LVL[] = {
-        4,
-        3,
-        2,
-        1,
-        0,
-    };
+constexpr varbitscale_entry_t _varbitscale_entry(_u32 scaled)
+{
+    return scaled >= RPLIDAR_VARBITSCALE_X16_DEST_VAL ? _varbitscale_level(scaled, RPLIDAR_VARBITSCALE_X16_DEST_VAL, RPLIDAR_VARBITSCALE_X16_SRC_BIT, 4)
+         : scaled >= RPLIDAR_VARBITSCALE_X8_DEST_VAL  ? _varbitscale_level(scaled, RPLIDAR_VARBITSCALE_X8_DEST_VAL, RPLIDAR_VARBITSCALE_X8_SRC_BIT, 3)
+         : scaled >= RPLIDAR_VARBITSCALE_X4_DEST_VAL  ? _varbitscale_level(scaled, RPLIDAR_VARBITSCALE_X4_DEST_VAL, RPLIDAR_VARBITSCALE_X4_SRC_BIT, 2)
+         : scaled >= RPLIDAR_VARBITSCALE_X2_DEST_VAL  ? _varbitscale_level(scaled, RPLIDAR_VARBITSCALE_X2_DEST_VAL, RPLIDAR_VARBITSCALE_X2_SRC_BIT, 1)
+         : varbitscale_entry_t{ _u16(scaled), 0 };
+}
 
-    static const _u32 VBS_TARGET_BASE[] = {
-        (0x1 << RPLIDAR_VARBITSCALE_X16_SRC_BIT),
-        (0x1 << RPLIDAR_VARBITSCALE_X8_SRC_BIT),
-        (0x1 << RPLIDAR_VARBITSCALE_X4_SRC_BIT),
-        (0x1 << RPLIDAR_VARBITSCALE_X2_SRC_BIT),
-        0,
-    };
+template <size_t... Is>
+constexpr varbitscale_lut_t _varbitscale_make_lut(_static_indices<Is...>)
+{
+    return varbitscale_lut_t{{
+        { _varbitscale_entry(0x000 + Is)... }, { _varbitscale_entry(0x100 + Is)... },
+        { _varbitscale_entry(0x200 + Is)... }, { _varbitscale_entry(0x300 + Is)... },
+        { _varbitscale_entry(0x400 + Is)... }, { _varbitscale_entry(0x500 + Is)... },
+        { _varbitscale_entry(0x600 + Is)... }, { _varbitscale_entry(0x700 + Is)... },
+        { _varbitscale_entry(0x800 + Is)... }, { _varbitscale_entry(0x900 + Is)... },
+        { _varbitscale_entry(0xA00 + Is)... }, { _varbitscale_entry(0xB00 + Is)... },
+        { _varbitscale_entry(0xC00 + Is)... }, { _varbitscale_entry(0xD00 + Is)... },
+        { _varbitscale_entry(0xE00 + Is)... }, { _varbitscale_entry(0xF00 + Is)... },
+    }};
+}
 
-    for (size_t i = 0; i < _countof(VBS_SCALED_BASE); ++i)
-    {
-        int remain = ((int)scaled - (int)VBS_SCALED_BASE[i]);
-        if (remain >= 0) {
-            scaleLevel = VBS_SCALED_LVL[i];
-            return VBS_TARGET_BASE[i] + (remain << scaleLevel);
-        }
-    }
-    return 0;
+static constexpr varbitscale_lut_t VBS_LUT = _varbitscale_make_lut(_make_static_indices<256>::type());
+
+static inline _u32 _varbitscale_decode(_u32 scaled, _u32 & scaleLevel)
+{
+    const varbitscale_entry_t & entry = VBS_LUT.entry[(scaled >> 8) & 0xF][scaled & 0xFF];
+    scaleLevel = entry.scaleLevel;
+    return entry.value;
+}
+
+// The ultra capsule angle correction in q16 degrees. It is a function of
+// k2 = ULTRA_ANGLE_K1 / dist_q2 for distances from 50mm on, so the table covers
+// every possible k2. The terms are evaluated exactly as the former per sample
+// floating point code did, just by the compiler.
+enum {
+    ULTRA_ANGLE_K1 = 98361,
+    ULTRA_ANGLE_MIN_DIST_Q2 = 50 * 4,
+    ULTRA_ANGLE_K2_COUNT = ULTRA_ANGLE_K1 / ULTRA_ANGLE_MIN_DIST_Q2 + 1,
+};
+
+typedef struct _ultra_angle_lut_t {
+    int correction_q16[ULTRA_ANGLE_K2_COUNT];
+} ultra_angle_lut_t;
+
+constexpr int _ultra_angle_to_deg_q16(int offsetAngleMean_q16)
+{
+    return int(offsetAngleMean_q16 * 180 / 3.14159265);
+}
+
+constexpr int _ultra_angle_correction(int k2)
+{
+    return _ultra_angle_to_deg_q16((int)(8 * 3.1415926535 * (1 << 16) / 180) - (k2 << 6) - (k2 * k2 * k2) / 98304);
+}
+
+template <size_t... Is>
+constexpr ultra_angle_lut_t _ultra_angle_make_lut(_static_indices<Is...>)
+{
+    return ultra_angle_lut_t{{ _ultra_angle_correction(Is)... }};
 }
 
-void RPlidarDriverImplCommon::_ultraCapsuleToNormal(const rplidar_response_ultra_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount)
+static constexpr ultra_angle_lut_t ULTRA_ANGLE_LUT = _ultra_angle_make_lut(_make_static_indices<ULTRA_ANGLE_K2_COUNT>::type());
+static constexpr int ULTRA_ANGLE_NEAR_CORRECTION_Q16 = _ultra_angle_to_deg_q16((int)(7.5 * 3.1415926535 * (1 << 16) / 180.0));
+
+void RPlidarDriverImplCommon::_ultraCapsuleToNormal(const rplidar_response_ultra_capsule_measurement_nodes_t & previous, const rplidar_response_ultra_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes)
 {
-    nodeCount = 0;
+    nodes.count = 0;
     if (_is_previous_capsuledataRdy) {
         int diffAngle_q8;
         int currentStartAngle_q8 = ((capsule.start_angle_sync_q6 & 0x7FFF) << 2);
-        int prevStartAngle_q8 = ((_cached_previous_ultracapsuledata.start_angle_sync_q6 & 0x7FFF) << 2);
+        int prevStartAngle_q8 = ((previous.start_angle_sync_q6 & 0x7FFF) << 2);
 
         diffAngle_q8 = (currentStartAngle_q8)-(prevStartAngle_q8);
         if (prevStartAngle_q8 >  currentStartAngle_q8) {
@@ -1159,14 +1119,14 @@ void RPlidarDriverImplCommon::_ultraCapsuleToNormal(const rplidar_response_ultra
 
         int angleInc_q16 = (diffAngle_q8 << 3) / 3;
         int currentAngle_raw_q16 = (prevStartAngle_q8 << 8);
-        for (size_t pos = 0; pos < _countof(_cached_previous_ultracapsuledata.ultra_cabins); ++pos)
+        for (size_t pos = 0; pos < _countof(previous.ultra_cabins); ++pos)
         {
             int dist_q2[3];
             int angle_q6[3];
             int syncBit[3];
 
 
-            _u32 combined_x3 = _cached_previous_ultracapsuledata.ultra_cabins[pos].combined_x3;
+            _u32 combined_x3 = previous.ultra_cabins[pos].combined_x3;
 
             // unpack ...
             int dist_major = (combined_x3 & 0xFFF);
@@ -1182,12 +1142,12 @@ void RPlidarDriverImplCommon::_ultraCapsuleToNormal(const rplidar_response_ultra
             _u32 scalelvl1, scalelvl2;
 
             // prefetch next ...
-            if (pos == _countof(_cached_previous_ultracapsuledata.ultra_cabins) - 1)
+            if (pos == _countof(previous.ultra_cabins) - 1)
             {
                 dist_major2 = (capsule.ultra_cabins[0].combined_x3 & 0xFFF);
             }
             else {
-                dist_major2 = (_cached_previous_ultracapsuledata.ultra_cabins[pos + 1].combined_x3 & 0xFFF);
+                dist_major2 = (previous.ultra_cabins[pos + 1].combined_x3 & 0xFFF);
             }
 
             // decode with the var bit scale ...
@@ -1226,36 +1186,28 @@ void RPlidarDriverImplCommon::_ultraCapsuleToNormal(const rplidar_response_ultra
 
                 syncBit[cpos] = (((currentAngle_raw_q16 + angleInc_q16) % (360 << 16)) < angleInc_q16) ? 1 : 0;
 
-                int offsetAngleMean_q16 = (int)(7.5 * 3.1415926535 * (1 << 16) / 180.0);
-
-                if (dist_q2[cpos] >= (50 * 4))
+                int correction_q16 = ULTRA_ANGLE_NEAR_CORRECTION_Q16;
+                if (dist_q2[cpos] >= ULTRA_ANGLE_MIN_DIST_Q2)
                 {
-                    const int k1 = 98361;
-                    const int k2 = int(k1 / dist_q2[cpos]);
-
-                    offsetAngleMean_q16 = (int)(8 * 3.1415926535 * (1 << 16) / 180) - (k2 << 6) - (k2 * k2 * k2) / 98304;
+                    correction_q16 = ULTRA_ANGLE_LUT.correction_q16[ULTRA_ANGLE_K1 / dist_q2[cpos]];
                 }
 
-                angle_q6[cpos] = ((currentAngle_raw_q16 - int(offsetAngleMean_q16 * 180 / 3.14159265)) >> 10);
+                angle_q6[cpos] = ((currentAngle_raw_q16 - correction_q16) >> 10);
                 currentAngle_raw_q16 += angleInc_q16;
 
                 if (angle_q6[cpos] < 0) angle_q6[cpos] += (360 << 6);
                 if (angle_q6[cpos] >= (360 << 6)) angle_q6[cpos] -= (360 << 6);
 
-                rplidar_response_measurement_node_hq_t node;
-
-                node.flag = (syncBit[cpos] | ((!syncBit[cpos]) << 1));
-                node.quality = dist_q2[cpos] ? (0x2F << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0;
-                node.angle_z_q14 = _u16((angle_q6[cpos] << 8) / 90);
-                node.dist_mm_q2 = dist_q2[cpos];
-
-                nodebuffer[nodeCount++] = node;
+                _pushNode(nodes,
+                    _u16((angle_q6[cpos] << 8) / 90),
+                    dist_q2[cpos],
+                    dist_q2[cpos] ? (0x2F << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0,
+                    (syncBit[cpos] | ((!syncBit[cpos]) << 1)));
             }
 
         }
     }
 
-    _cached_previous_ultracapsuledata = capsule;
     _is_previous_capsuledataRdy = true;
 }
 
@@ -1693,6 +1645,16 @@ u_result RPlidarDriverImplCommon::startScanExpress(bool force, _u16 scanMode, _u
         }
     }
 
+    // the cache thread spaces the node timestamps by the sample duration
+    float sampleDuration = _cached_sampleduration_express;
+    if (outUsedScanMode) {
+        sampleDuration = outUsedScanMode->us_per_sample;
+    } else if (ifSupportLidarConf) {
+        getLidarSampleDuration(sampleDuration, scanMode);
+    }
+    _sampleDurationUs = sampleDuration;
+    _sizeScanBuffers();
+
     //get scan answer type to specify how to wait data
     _u8 scanAnsType;
     if (ifSupportLidarConf)
@@ -1735,25 +1697,23 @@ u_result RPlidarDriverImplCommon::startScanExpress(bool force, _u16 scanMode, _u
             if (header_size < sizeof(rplidar_response_capsule_measurement_nodes_t)) {
                 return RESULT_INVALID_DATA;
             }
-            _cached_express_flag = 0;
             _isScanning = true;
-            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheCapsuledScanData);
+            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData<CapsuleScanMode>);
         }
         else if (scanAnsType == RPLIDAR_ANS_TYPE_MEASUREMENT_DENSE_CAPSULED)
         {
             if (header_size < sizeof(rplidar_response_capsule_measurement_nodes_t)) {
                 return RESULT_INVALID_DATA;
             }
-            _cached_express_flag = 1;
             _isScanning = true;
-            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheCapsuledScanData);
+            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData<DenseCapsuleScanMode>);
         }
         else if (scanAnsType == RPLIDAR_ANS_TYPE_MEASUREMENT_HQ) {
             if (header_size < sizeof(rplidar_response_hq_capsule_measurement_nodes_t)) {
                 return RESULT_INVALID_DATA;
             }
             _isScanning = true;
-            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheHqScanData);
+            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData<HqScanMode>);
         }
         else
         {
@@ -1761,7 +1721,7 @@ u_result RPlidarDriverImplCommon::startScanExpress(bool force, _u16 scanMode, _u
                 return RESULT_INVALID_DATA;
             }
             _isScanning = true;
-            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheUltraCapsuledScanData);
+            _cachethread = CLASS_THREAD(RPlidarDriverImplCommon, _cacheScanData<UltraCapsuleScanMode>);
         }
 
         if (_cachethread.getHandle() == 0) {
@@ -1790,78 +1750,112 @@ u_result RPlidarDriverImplCommon::grabScanData(rplidar_response_measurement_node
 {
     DEPRECATED_WARN("grabScanData()", "grabScanDataHq()");
 
-    switch ((int)_dataEvt.wait(timeout))
-    {
-    case rp::hal::Event::EVENT_TIMEOUT:
+    _u32 index;
+    u_result ans = _scanQueue.acquire(index, timeout);
+    if (IS_FAIL(ans)) {
         count = 0;
-        return RESULT_OPERATION_TIMEOUT;
-    case rp::hal::Event::EVENT_OK:
-        {
-            if(_cached_scan_node_hq_count == 0) return RESULT_OPERATION_TIMEOUT; //consider as timeout
-
-            rp::hal::AutoLocker l(_lock);
-
-            size_t size_to_copy = min(count, _cached_scan_node_hq_count);
-
-            for (size_t i = 0; i < size_to_copy; i++)
-                convert(_cached_scan_node_hq_buf[i], nodebuffer[i]);
+        return ans;
+    }
 
-            count = size_to_copy;
-            _cached_scan_node_hq_count = 0;
-        }
-        return RESULT_OK;
+    const RplidarScanSoA & scan = _scanQueue.buffer(index);
+    size_t size_to_copy = min(count, scan.count);
 
-    default:
-        count = 0;
-        return RESULT_OPERATION_FAIL;
+    for (size_t i = 0; i < size_to_copy; i++) {
+        rplidar_response_measurement_node_hq_t node;
+        _packNode(scan, i, node);
+        convert(node, nodebuffer[i]);
     }
+
+    count = size_to_copy;
+    _scanQueue.releaseLeaseRef(index);
+    return RESULT_OK;
 }
 
 u_result RPlidarDriverImplCommon::grabScanDataHq(rplidar_response_measurement_node_hq_t * nodebuffer, size_t & count, _u32 timeout)
 {
-    switch ((int)_dataEvt.wait(timeout))
-    {
-    case rp::hal::Event::EVENT_TIMEOUT:
+    _u32 index;
+    u_result ans = _scanQueue.acquire(index, timeout);
+    if (IS_FAIL(ans)) {
         count = 0;
-        return RESULT_OPERATION_TIMEOUT;
-    case rp::hal::Event::EVENT_OK:
-    {
-        if (_cached_scan_node_hq_count == 0) return RESULT_OPERATION_TIMEOUT; //consider as timeout
+        return ans;
+    }
 
-        rp::hal::AutoLocker l(_lock);
+    const RplidarScanSoA & scan = _scanQueue.buffer(index);
+    size_t size_to_copy = min(count, scan.count);
+    for (size_t i = 0; i < size_to_copy; i++)
+        _packNode(scan, i, nodebuffer[i]);
 
-        size_t size_to_copy = min(count, _cached_scan_node_hq_count);
-        memcpy(nodebuffer, _cached_scan_node_hq_buf, size_to_copy * sizeof(rplidar_response_measurement_node_hq_t));
+    count = size_to_copy;
+    _scanQueue.releaseLeaseRef(index);
+    return RESULT_OK;
+}
 
-        count = size_to_copy;
-        _cached_scan_node_hq_count = 0;
+u_result RPlidarDriverImplCommon::grabScanDataHq(RplidarScanSoA & scan, _u32 timeout)
+{
+    _u32 index;
+    u_result ans = _scanQueue.acquire(index, timeout);
+    if (IS_FAIL(ans)) {
+        scan.count = 0;
+        return ans;
     }
+
+    const RplidarScanSoA & queued = _scanQueue.buffer(index);
+    size_t size_to_copy = min(scan.capacity, queued.count);
+    _copyNodes(scan, 0, queued, 0, size_to_copy);
+
+    scan.count = size_to_copy;
+    scan.seq = queued.seq;
+    _scanQueue.releaseLeaseRef(index);
     return RESULT_OK;
+}
 
-    default:
-        count = 0;
-        return RESULT_OPERATION_FAIL;
-    }
+u_result RPlidarDriverImplCommon::grabScanLease(RplidarScanLease & lease, _u32 timeout)
+{
+    lease.release();
+
+    _u32 index;
+    u_result ans = _scanQueue.acquire(index, timeout);
+    if (IS_FAIL(ans)) return ans;
+
+    lease = RplidarScanLease(&_scanQueue, index, &_scanQueue.buffer(index));
+    return RESULT_OK;
+}
+
+u_result RPlidarDriverImplCommon::setScanQueuePolicy(_u32 policy)
+{
+    if (policy != SCAN_QUEUE_DROP_OLDEST && policy != SCAN_QUEUE_DROP_NEWEST) return RESULT_INVALID_DATA;
+    _scanQueue.setDropPolicy(policy);
+    return RESULT_OK;
+}
+
+void RPlidarDriverImplCommon::getScanQueueStats(_u64 & completed, _u64 & dropped)
+{
+    _scanQueue.getStats(completed, dropped);
 }
 
 u_result RPlidarDriverImplCommon::getScanDataWithInterval(rplidar_response_measurement_node_t * nodebuffer, size_t & count)
 {
     DEPRECATED_WARN("getScanDataWithInterval(rplidar_response_measurement_node_t*, size_t&)", "getScanDataWithInterval(rplidar_response_measurement_node_hq_t*, size_t&)");
 
+    //copy the nodes available on entry, the cache thread keeps pushing while we drain and
+    //callers size nodebuffer for the MAX_SCAN_NODES nodes the old cached buffer held
+    rplidar_response_measurement_node_hq_t hqNodes[64];
     size_t size_to_copy = 0;
-    {
-        rp::hal::AutoLocker l(_lock);
-        if(_cached_scan_node_hq_count_for_interval_retrieve == 0)
-        {
-            return RESULT_OPERATION_TIMEOUT; 
-        }
-        //copy all the nodes(_cached_scan_node_count_for_interval_retrieve nodes) in _cached_scan_node_buf_for_interval_retrieve
-        size_to_copy = _cached_scan_node_hq_count_for_interval_retrieve;
-        for (size_t i = 0; i < size_to_copy; i++)
+    size_t remaining = _intervalRing.available();
+    if (remaining > MAX_SCAN_NODES) remaining = MAX_SCAN_NODES;
+    size_t chunk;
+    while (remaining > 0 &&
+           (chunk = _intervalRing.pop(hqNodes, remaining < _countof(hqNodes) ? remaining : _countof(hqNodes))) != 0) {
+        for (size_t i = 0; i < chunk; i++)
         {
-            convert(_cached_scan_node_hq_buf_for_interval_retrieve[i], nodebuffer[i]);
+            convert(hqNodes[i], nodebuffer[size_to_copy + i]);
         }
-        _cached_scan_node_hq_count_for_interval_retrieve = 0;
+        size_to_copy += chunk;
+        remaining -= chunk;
+    }
+    if (size_to_copy == 0)
+    {
+        return RESULT_OPERATION_TIMEOUT; 
     }
     count = size_to_copy;
 
@@ -1875,26 +1869,146 @@ u_result RPlidarDriverImplCommon::getScanDataWithIntervalHq(rplidar_response_mea
     // count to 0.
     if (_isScanning)
     {
-        rp::hal::AutoLocker l(_lock);
-        if (_cached_scan_node_hq_count_for_interval_retrieve == 0)
+        if (_intervalRing.available() == 0)
         {
             return RESULT_OPERATION_TIMEOUT;
         }
-        // Copy at most count nodes from _cached_scan_node_buf_for_interval_retrieve
-        size_to_copy = min(_cached_scan_node_hq_count_for_interval_retrieve, count);
-        memcpy(nodebuffer, _cached_scan_node_hq_buf_for_interval_retrieve, size_to_copy * sizeof(rplidar_response_measurement_node_hq_t));
-        _cached_scan_node_hq_count_for_interval_retrieve -= size_to_copy;
-        // Move remaining data to the start of the array.
-        memmove(&_cached_scan_node_hq_buf_for_interval_retrieve[0], &_cached_scan_node_hq_buf_for_interval_retrieve[size_to_copy], _cached_scan_node_hq_count_for_interval_retrieve *  sizeof(rplidar_response_measurement_node_hq_t));
+        // Copy at most count nodes, the rest stays where it is
+        size_to_copy = _intervalRing.pop(nodebuffer, count);
     }
     count = size_to_copy;
 
 	// If there is remaining data, return with a warning.
-	if (_cached_scan_node_hq_count_for_interval_retrieve > 0)
+	if (_intervalRing.available() > 0)
 		return RESULT_REMAINING_DATA;
     return RESULT_OK;
 }
 
+u_result RPlidarDriverImplCommon::getScanDataWithIntervalHq(RplidarScanSoA & nodes, _u32 timeout)
+{
+    nodes.count = 0;
+
+    u_result ans = _intervalRing.wait(timeout);
+    if (IS_FAIL(ans)) return ans;
+
+    _intervalRing.pop(nodes);
+    if (_intervalRing.available() > 0)
+        return RESULT_REMAINING_DATA;
+    return RESULT_OK;
+}
+
+void RPlidarDriverImplCommon::getScanDataWithIntervalStats(_u64 & queued, _u64 & dropped)
+{
+    _intervalRing.getStats(queued, dropped);
+}
+
+void RPlidarDriverImplCommon::setScanBufferMinRPM(float rpm)
+{
+    if (rpm > 0) _minScanRpm = rpm;
+}
+
+size_t RPlidarDriverImplCommon::getMaxScanNodes()
+{
+    return _maxScanNodes;
+}
+
+size_t RPlidarDriverImplCommon::getScanBufferSize()
+{
+    return _scanArena.size();
+}
+
+u_result RPlidarDriverImplCommon::setScanGrid(size_t bins, _u32 policy)
+{
+    if (bins > MAX_SCAN_NODES || policy > SCAN_GRID_MEAN) return RESULT_INVALID_DATA;
+    if (_isScanning) return RESULT_OPERATION_FAIL;
+    _scanGrid.configure(bins, policy);
+    return RESULT_OK;
+}
+
+u_result RPlidarDriverImplCommon::grabScanGrid(RplidarScanGrid & grid, _u32 timeout)
+{
+    if (!_scanGrid.bins()) return RESULT_OPERATION_NOT_SUPPORT;
+    return _scanGrid.grab(grid, timeout);
+}
+
+u_result RPlidarDriverImplCommon::getRotationSpeed(float & rpm, _u64 & timestamp_us)
+{
+    return _rotation.get(rpm, timestamp_us) ? RESULT_OK : RESULT_OPERATION_FAIL;
+}
+
+// Scratch of the ascendScanData sorts for count nodes: a copy of the nodes or the keys
+// of the radix sort, the sorted keys and the angles. A sort takes the driver's own
+// while it is big enough and no other sort holds it, otherwise heap memory of its own.
+class _SortScratch
+{
+public:
+    enum {
+        BYTES_PER_NODE = sizeof(rplidar_response_measurement_node_hq_t) + sizeof(_u32) + sizeof(_u16),
+    };
+
+    _SortScratch(_u8 * block, size_t capacity, bool & busy)
+        : spare(NULL), keys(NULL), angles(NULL)
+        , _block(block), _capacity(capacity), _busy(busy), _taken(false), _heap(NULL)
+    {
+    }
+
+    ~_SortScratch()
+    {
+        delete[] _heap;
+        if (_taken) __atomic_store_n(&_busy, false, __ATOMIC_RELEASE);
+    }
+
+    void take(size_t count)
+    {
+        _u8 * base;
+        if (_block && count <= _capacity && !__atomic_exchange_n(&_busy, true, __ATOMIC_ACQUIRE)) {
+            _taken = true;
+            base = _block;
+        } else {
+            base = _heap = new _u8[count * BYTES_PER_NODE];
+        }
+        spare = base;
+        keys = reinterpret_cast<_u32 *>(base + count * sizeof(rplidar_response_measurement_node_hq_t));
+        angles = reinterpret_cast<_u16 *>(keys + count);
+    }
+
+    void * spare;   // count nodes or count keys
+    _u32 * keys;
+    _u16 * angles;
+
+private:
+    _SortScratch(const _SortScratch &);
+    _SortScratch & operator=(const _SortScratch &);
+
+    _u8 *  _block;
+    size_t _capacity;
+    bool & _busy;
+    bool   _taken;
+    _u8 *  _heap;
+};
+
+// One revolution at _minScanRpm for every scan buffer, rounded up to a power of 2 for
+// the interval ring, and the sort scratch for as many nodes. Leased scans point into
+// the arena, so while any is out or a sort runs the buffers stay as they are.
+void RPlidarDriverImplCommon::_sizeScanBuffers()
+{
+    if (_maxScanNodes && (_scanQueue.taken() || __atomic_load_n(&_sortScratchBusy, __ATOMIC_ACQUIRE))) return;
+
+    size_t nodes = (size_t)(60000000.f / (_minScanRpm * _sampleDurationUs)) + 1;
+    if (nodes < MIN_SCAN_NODES) nodes = MIN_SCAN_NODES;
+    if (nodes > MAX_SCAN_NODES) nodes = MAX_SCAN_NODES;
+
+    size_t ringNodes = MIN_SCAN_NODES;
+    while (ringNodes < nodes) ringNodes <<= 1;
+
+    _scanArena.reset(ScanQueue::BUFFERS * RplidarScanArena::bytesFor(nodes) + RplidarScanArena::bytesFor(ringNodes)
+        + nodes * _SortScratch::BYTES_PER_NODE);
+    _scanQueue.carve(_scanArena, nodes);
+    _intervalRing.carve(_scanArena, ringNodes);
+    _scanArena.carve(_sortScratch, nodes * _SortScratch::BYTES_PER_NODE);
+    _maxScanNodes = nodes;
+}
+
 static inline float getAngle(const rplidar_response_measurement_node_t& node)
 {
     return (node.angle_q6_checkbit >> RPLIDAR_RESP_MEASUREMENT_ANGLE_SHIFT) / 64.f;
@@ -1926,14 +2040,95 @@ static inline _u32 getDistanceQ2(const rplidar_response_measurement_node_hq_t& n
     return node.dist_mm_q2;
 }
 
+// integer angles and the angle of half a turn in their units
+static inline _u16 getAngleKey(const rplidar_response_measurement_node_t& node)
+{
+    return node.angle_q6_checkbit >> RPLIDAR_RESP_MEASUREMENT_ANGLE_SHIFT;
+}
+
+static inline _u16 getAngleKey(const rplidar_response_measurement_node_hq_t& node)
+{
+    return node.angle_z_q14;
+}
+
+static inline _u32 getHalfTurn(const rplidar_response_measurement_node_t *)
+{
+    return 180 << 6;
+}
+
+static inline _u32 getHalfTurn(const rplidar_response_measurement_node_hq_t *)
+{
+    return 1 << 15;
+}
+
 template <class TNode>
 static bool angleLessThan(const TNode& a, const TNode& b)
 {
-    return getAngle(a) < getAngle(b);
+    return getAngleKey(a) < getAngleKey(b);
+}
+
+// Two stable counting passes over the angle bytes of keys (angle << 16 | index)
+static void _radixSortAngleKeys(_u32 * keys, size_t count, _u32 * scratch)
+{
+    size_t low[257] = {0};
+    size_t high[257] = {0};
+    for (size_t i = 0; i < count; i++) {
+        low[((keys[i] >> 16) & 0xFF) + 1]++;
+        high[(keys[i] >> 24) + 1]++;
+    }
+    for (size_t i = 1; i < 257; i++) {
+        low[i] += low[i - 1];
+        high[i] += high[i - 1];
+    }
+    for (size_t i = 0; i < count; i++) {
+        scratch[low[(keys[i] >> 16) & 0xFF]++] = keys[i];
+    }
+    for (size_t i = 0; i < count; i++) {
+        keys[high[scratch[i] >> 24]++] = scratch[i];
+    }
+}
+
+// Sorts the keys (angle << 16 | index) of a scan in ascending angle order. A scan
+// starts close to the sync point, so its angles climb through one turn with a single
+// wrap and a little jitter. The keys are laid out from behind the wrap and an insertion
+// sort repairs the jitter in linear time; a scan that needs more than a few moves per
+// node isn't shaped like that and is radix sorted instead.
+static void _sortAngleKeys(const _u16 * angles, size_t count, _u32 halfTurn, _u32 * keys, _u32 * scratch)
+{
+    const size_t movesPerNode = 8;
+
+    size_t start = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (angles[i - 1] > angles[i] + halfTurn) {
+            start = i;
+            break;
+        }
+    }
+    for (size_t j = 0, i = start; j < count; j++) {
+        keys[j] = ((_u32)angles[i] << 16) | (_u32)i;
+        if (++i == count) i = 0;
+    }
+
+    size_t budget = count * movesPerNode;
+    for (size_t i = 1; i < count; i++) {
+        _u32 key = keys[i];
+        size_t j = i;
+        while (j > 0 && keys[j - 1] > key) {
+            keys[j] = keys[j - 1];
+            --j;
+        }
+        keys[j] = key;
+
+        if (i - j > budget) {
+            _radixSortAngleKeys(keys, count, scratch);
+            return;
+        }
+        budget -= i - j;
+    }
 }
 
 template < class TNode >
-static u_result ascendScanData_(TNode * nodebuffer, size_t count)
+static u_result ascendScanData_(TNode * nodebuffer, size_t count, _SortScratch & scratch)
 {
     float inc_origin_angle = 360.f/count;
     size_t i = 0;
@@ -1982,8 +2177,24 @@ static u_result ascendScanData_(TNode * nodebuffer, size_t count)
     }
 
     // Reorder the scan according to the angle value
-    std::sort(nodebuffer, nodebuffer + count, &angleLessThan<TNode>);
+    if (count > RPlidarDriver::MAX_SCAN_NODES) {
+        std::sort(nodebuffer, nodebuffer + count, &angleLessThan<TNode>);
+        return RESULT_OK;
+    }
+
+    scratch.take(count);
+    _u16 * angles = scratch.angles;
+    _u32 * keys = scratch.keys;
+    for (i = 0; i < count; i++) {
+        angles[i] = getAngleKey(nodebuffer[i]);
+    }
+    _sortAngleKeys(angles, count, getHalfTurn(nodebuffer), keys, static_cast<_u32 *>(scratch.spare));
 
+    TNode * nodes = static_cast<TNode *>(scratch.spare);
+    memcpy(nodes, nodebuffer, count * sizeof(TNode));
+    for (i = 0; i < count; i++) {
+        nodebuffer[i] = nodes[keys[i] & 0xFFFF];
+    }
     return RESULT_OK;
 }
 
@@ -1991,12 +2202,143 @@ u_result RPlidarDriverImplCommon::ascendScanData(rplidar_response_measurement_no
 {
     DEPRECATED_WARN("ascendScanData(rplidar_response_measurement_node_t*, size_t)", "ascendScanData(rplidar_response_measurement_node_hq_t*, size_t)");
 
-    return ascendScanData_<rplidar_response_measurement_node_t>(nodebuffer, count);
+    _SortScratch scratch(_sortScratch, _maxScanNodes, _sortScratchBusy);
+    return ascendScanData_<rplidar_response_measurement_node_t>(nodebuffer, count, scratch);
 }
 
 u_result RPlidarDriverImplCommon::ascendScanData(rplidar_response_measurement_node_hq_t * nodebuffer, size_t count)
 {
-    return ascendScanData_<rplidar_response_measurement_node_hq_t>(nodebuffer, count);
+    _SortScratch scratch(_sortScratch, _maxScanNodes, _sortScratchBusy);
+    return ascendScanData_<rplidar_response_measurement_node_hq_t>(nodebuffer, count, scratch);
+}
+
+// Sort keys (angle << 16 | index) of the scan in ascending angle order, the angles of
+// invalid nodes are filled in the same way as ascendScanData_ does
+static u_result _ascendScanKeys(const RplidarScanSoA & scan, _u16 * angles, _u32 * keys, _u32 * scratch)
+{
+    const size_t count = scan.count;
+    memcpy(angles, scan.angle_z_q14, count * sizeof(_u16));
+
+    float inc_origin_angle = 360.f/count;
+    size_t i = 0;
+
+    //Tune head
+    for (i = 0; i < count; i++) {
+        if (scan.dist_mm_q2[i] == 0) {
+            continue;
+        } else {
+            while (i != 0) {
+                i--;
+                float expect_angle = angles[i+1] * 90.f / 16384.f - inc_origin_angle;
+                if (expect_angle < 0.0f) expect_angle = 0.0f;
+                angles[i] = _u16(_u32(expect_angle * 16384.f / 90.f));
+            }
+            break;
+        }
+    }
+
+    // all the data is invalid
+    if (i == count) return RESULT_OPERATION_FAIL;
+
+    //Tune tail
+    for (i = count - 1; ; i--) {
+        if (scan.dist_mm_q2[i] == 0) {
+            continue;
+        } else {
+            while (i != (count - 1)) {
+                i++;
+                float expect_angle = angles[i-1] * 90.f / 16384.f + inc_origin_angle;
+                if (expect_angle > 360.0f) expect_angle -= 360.0f;
+                angles[i] = _u16(_u32(expect_angle * 16384.f / 90.f));
+            }
+            break;
+        }
+    }
+
+    //Fill invalid angle in the scan
+    float frontAngle = angles[0] * 90.f / 16384.f;
+    for (i = 1; i < count; i++) {
+        if (scan.dist_mm_q2[i] == 0) {
+            float expect_angle =  frontAngle + i * inc_origin_angle;
+            if (expect_angle > 360.0f) expect_angle -= 360.0f;
+            angles[i] = _u16(_u32(expect_angle * 16384.f / 90.f));
+        }
+    }
+
+    // the angles come straight out of the keys, the other arrays are gathered by index
+    _sortAngleKeys(angles, count, 1 << 15, keys, scratch);
+    return RESULT_OK;
+}
+
+u_result RPlidarDriverImplCommon::ascendScanData(RplidarScanSoA & scan)
+{
+    const size_t count = scan.count;
+    if (count > MAX_SCAN_NODES) return RESULT_INSUFFICIENT_MEMORY;
+
+    _SortScratch sortScratch(_sortScratch, _maxScanNodes, _sortScratchBusy);
+    sortScratch.take(count);
+    _u32 * keys = sortScratch.keys;
+    _u32 * scratch = static_cast<_u32 *>(sortScratch.spare);
+    u_result ans = _ascendScanKeys(scan, sortScratch.angles, keys, scratch);
+    if (IS_FAIL(ans)) return ans;
+
+    memcpy(scratch, scan.dist_mm_q2, count * sizeof(_u32));
+    for (size_t i = 0; i < count; i++) {
+        scan.angle_z_q14[i] = _u16(keys[i] >> 16);
+        scan.dist_mm_q2[i] = scratch[keys[i] & 0xFFFF];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        scratch[i] = scan.quality[i] | ((_u32)scan.flag[i] << 8);
+    }
+    for (size_t i = 0; i < count; i++) {
+        _u32 qf = scratch[keys[i] & 0xFFFF];
+        scan.quality[i] = _u8(qf);
+        scan.flag[i] = _u8(qf >> 8);
+    }
+
+    if (scan.timestamp_us) {
+        // a scan lasts well below 2^31us, so the offsets to its first node fit the scratch
+        const _u64 base = scan.timestamp_us[0];
+        for (size_t i = 0; i < count; i++) {
+            scratch[i] = _u32(scan.timestamp_us[i] - base);
+        }
+        for (size_t i = 0; i < count; i++) {
+            scan.timestamp_us[i] = base + (_u64)(_s64)(_s32)scratch[keys[i] & 0xFFFF];
+        }
+    }
+
+    return RESULT_OK;
+}
+
+u_result RPlidarDriverImplCommon::ascendScanData(const RplidarScanSoA & scan, RplidarScanSoA & sorted)
+{
+    if (&scan == &sorted) return ascendScanData(sorted);
+
+    const size_t count = scan.count;
+    if (count > MAX_SCAN_NODES || count > sorted.capacity) return RESULT_INSUFFICIENT_MEMORY;
+
+    _SortScratch sortScratch(_sortScratch, _maxScanNodes, _sortScratchBusy);
+    sortScratch.take(count);
+    _u32 * keys = sortScratch.keys;
+    u_result ans = _ascendScanKeys(scan, sortScratch.angles, keys, static_cast<_u32 *>(sortScratch.spare));
+    if (IS_FAIL(ans)) return ans;
+
+    for (size_t i = 0; i < count; i++) {
+        _u32 from = keys[i] & 0xFFFF;
+        sorted.angle_z_q14[i] = _u16(keys[i] >> 16);
+        sorted.dist_mm_q2[i] = scan.dist_mm_q2[from];
+        sorted.quality[i] = scan.quality[from];
+        sorted.flag[i] = scan.flag[from];
+    }
+    if (sorted.timestamp_us && scan.timestamp_us) {
+        for (size_t i = 0; i < count; i++) {
+            sorted.timestamp_us[i] = scan.timestamp_us[keys[i] & 0xFFFF];
+        }
+    }
+    sorted.count = count;
+    sorted.seq = scan.seq;
+    return RESULT_OK;
 }
 
 u_result RPlidarDriverImplCommon::_sendCommand(_u8 cmd, const void * payload, size_t payloadsize)
@@ -2216,9 +2558,9 @@ void RPlidarDriverImplCommon::_disableDataGrabbing()
 
 // Serial Driver Impl
 
-RPlidarDriverSerial::RPlidarDriverSerial() 
+RPlidarDriverSerial::RPlidarDriverSerial(_u32 rxtxType) 
 {
-    _chanDev = new SerialChannelDevice();
+    _chanDev = new SerialChannelDevice(rxtxType);
 }
 
 RPlidarDriverSerial::~RPlidarDriverSerial()
@@ -2253,6 +2595,8 @@ u_result RPlidarDriverSerial::connect(const char * port_path, _u32 baudrate, _u3
     }
 
     _isConnected = true;
+    _stdSampleDurationUs = 0;
+    _usPerByte = baudrate ? 10e6f / baudrate : 0; // 8N1
 
     checkMotorCtrlSupport(_isSupportingMotorCtrl);
     stopMotor();
@@ -2260,6 +2604,31 @@ u_result RPlidarDriverSerial::connect(const char * port_path, _u32 baudrate, _u3
     return RESULT_OK;
 }
 
+u_result RPlidarDriverSerial::startCapture(const char * basepath, size_t segment_size)
+{
+    if (!_chanDev) return RESULT_INSUFFICIENT_MEMORY;
+
+    SerialChannelDevice * dev = static_cast<SerialChannelDevice *>(_chanDev);
+    return dev->startCapture(basepath, segment_size) ? RESULT_OK : RESULT_OPERATION_FAIL;
+}
+
+void RPlidarDriverSerial::stopCapture()
+{
+    if (!_chanDev) return;
+    static_cast<SerialChannelDevice *>(_chanDev)->stopCapture();
+}
+
+void RPlidarDriverSerial::getCaptureStats(_u64 & captured, _u64 & dropped)
+{
+    captured = dropped = 0;
+    if (!_chanDev) return;
+
+    rp::hal::rx_capture * capture = static_cast<SerialChannelDevice *>(_chanDev)->getCapture();
+    if (!capture) return;
+    captured = capture->getCapturedBytes();
+    dropped = capture->getDroppedBytes();
+}
+
 RPlidarDriverTCP::RPlidarDriverTCP() 
 {
     _chanDev = new TCPChannelDevice();
@@ -2293,6 +2662,53 @@ u_result RPlidarDriverTCP::connect(const char * ipStr, _u32 port, _u32 flag)
     }
 
     _isConnected = true;
+    _stdSampleDurationUs = 0;
+
+    checkMotorCtrlSupport(_isSupportingMotorCtrl);
+    stopMotor();
+
+    return RESULT_OK;
+}
+
+RPlidarDriverReplay::RPlidarDriverReplay() 
+{
+    _chanDev = new ReplayChannelDevice();
+}
+
+RPlidarDriverReplay::~RPlidarDriverReplay()
+{
+    // force disconnection
+    disconnect();
+
+    _chanDev->close();
+    delete _chanDev;
+    _chanDev = NULL;
+}
+
+void RPlidarDriverReplay::disconnect()
+{
+    if (!_isConnected) return ;
+    stop();
+}
+
+u_result RPlidarDriverReplay::connect(const char * file_path, _u32 baudrate, _u32 flag)
+{
+    if (isConnected()) return RESULT_ALREADY_DONE;
+
+    if (!_chanDev) return RESULT_INSUFFICIENT_MEMORY;
+
+    {
+        rp::hal::AutoLocker l(_lock);
+
+        // load the recording...
+        if (!_chanDev->bind(file_path, baudrate)) {
+            return RESULT_INVALID_DATA;
+        }
+    }
+
+    _isConnected = true;
+    _stdSampleDurationUs = 0;
+    _usPerByte = baudrate ? 10e6f / baudrate : 0;
 
     checkMotorCtrlSupport(_isSupportingMotorCtrl);
     stopMotor();
@@ -2300,4 +2716,17 @@ u_result RPlidarDriverTCP::connect(const char * ipStr, _u32 port, _u32 flag)
     return RESULT_OK;
 }
 
+u_result RPlidarDriverReplay::setReplaySpeed(float speed)
+{
+    // the cache thread paces the playback by the speed
+    if (_isScanning) return RESULT_OPERATION_FAIL;
+    static_cast<ReplayChannelDevice *>(_chanDev)->setReplaySpeed(speed);
+    return RESULT_OK;
+}
+
+bool RPlidarDriverReplay::isReplayFinished()
+{
+    return static_cast<ReplayChannelDevice *>(_chanDev)->isReplayFinished();
+}
+
 }}}
@@ -60,14 +60,261 @@ struct RplidarScanMode {
     char    scan_mode[64];    // name of scan mode, max 63 characters
 };
 
+/// Structure-of-arrays form of a scan, node i is made of angle_z_q14[i], dist_mm_q2[i],
+/// quality[i] and flag[i] with the same meaning as in rplidar_response_measurement_node_hq_t.
+/// Unlike the packed node every field is naturally aligned, so a scan can be copied, sorted
+/// and converted with plain (or SIMD) loads.
+/// timestamp_us[i] is the host time (CLOCK_MONOTONIC, microseconds) node i was measured at.
+/// It is estimated from when the frame carrying the node arrived, going back one
+/// us_per_sample per node, so it shares the fixed delay of the serial transfer.
+struct RplidarScanSoA {
+    enum {
+        ALIGNMENT = 16, // alignment of every array
+    };
+
+    _u16 *  angle_z_q14;
+    _u32 *  dist_mm_q2;
+    _u8  *  quality;
+    _u8  *  flag;
+    _u64 *  timestamp_us; // may be NULL when the timestamps are not wanted
+    size_t  count;      // nodes held
+    size_t  capacity;   // nodes each array has room for
+    _u64    seq;        // number of the scan, counts every scan completed since the driver was created
+};
+
+/// RplidarScanSoA with its own storage for N nodes
+template <size_t N>
+struct RplidarScanSoABuffer : public RplidarScanSoA {
+    RplidarScanSoABuffer()
+    {
+        angle_z_q14 = _angle_z_q14;
+        dist_mm_q2  = _dist_mm_q2;
+        quality     = _quality;
+        flag        = _flag;
+        timestamp_us = _timestamp_us;
+        count       = 0;
+        capacity    = N;
+        seq         = 0;
+    }
+
+private:
+    // the arrays are referenced by pointer, a copy would point into the original
+    RplidarScanSoABuffer(const RplidarScanSoABuffer &);
+    RplidarScanSoABuffer & operator=(const RplidarScanSoABuffer &);
+
+    alignas(ALIGNMENT) _u64 _timestamp_us[N];
+    alignas(ALIGNMENT) _u32 _dist_mm_q2[N];
+    alignas(ALIGNMENT) _u16 _angle_z_q14[N];
+    alignas(ALIGNMENT) _u8  _quality[N];
+    alignas(ALIGNMENT) _u8  _flag[N];
+};
+
+/// One revolution resampled onto bins evenly spaced angles, see RPlidarDriver::setScanGrid.
+/// Bin i takes the nodes with i * 360 / bins <= angle < (i + 1) * 360 / bins degrees.
+struct RplidarScanGrid {
+    _u32 *  dist_mm_q2; // 0 when no valid node fell into the bin
+    _u8  *  quality;
+    size_t  bins;       // bins each array has room for
+    _u64    start_us;   // timestamp_us of the first and the last node of the revolution
+    _u64    end_us;
+    _u64    seq;        // number of the revolution, counts every grid completed since setScanGrid
+};
+
+/// Storage for scans whose capacity is only known at run time. The scans carved out of
+/// it share one allocation, which reset() keeps as long as it is big enough, so sizing
+/// the scans again for another scan mode doesn't go back to the heap.
+class RplidarScanArena
+{
+public:
+    RplidarScanArena()
+        : _block(NULL), _base(NULL), _size(0), _used(0)
+    {
+    }
+
+    ~RplidarScanArena()
+    {
+        delete[] _block;
+    }
+
+    /// Bytes a scan of capacity nodes takes up in the arena
+    static size_t bytesFor(size_t capacity)
+    {
+        return _aligned(capacity) * (sizeof(_u64) + sizeof(_u32) + sizeof(_u16) + 2 * sizeof(_u8));
+    }
+
+    /// Gives up all scans carved so far and makes room for size bytes of new ones
+    void reset(size_t size)
+    {
+        _used = 0;
+        if (size <= _size) return;
+
+        delete[] _block;
+        _block = new _u8[size + RplidarScanSoA::ALIGNMENT];
+        _base = _block + (RplidarScanSoA::ALIGNMENT - (size_t)_block % RplidarScanSoA::ALIGNMENT) % RplidarScanSoA::ALIGNMENT;
+        _size = size;
+    }
+
+    /// Points scan at room for capacity nodes, false when the arena is used up
+    bool carve(RplidarScanSoA & scan, size_t capacity)
+    {
+        const size_t bytes = bytesFor(capacity);
+        if (_used + bytes > _size) return false;
+
+        const size_t n = _aligned(capacity);
+        _u8 * base = _base + _used;
+        scan.timestamp_us = reinterpret_cast<_u64 *>(base);
+        scan.dist_mm_q2   = reinterpret_cast<_u32 *>(base + n * sizeof(_u64));
+        scan.angle_z_q14  = reinterpret_cast<_u16 *>(base + n * (sizeof(_u64) + sizeof(_u32)));
+        scan.quality      = base + n * (sizeof(_u64) + sizeof(_u32) + sizeof(_u16));
+        scan.flag         = scan.quality + n;
+        scan.count        = 0;
+        scan.capacity     = capacity;
+        scan.seq          = 0;
+        _used += bytes;
+        return true;
+    }
+
+    /// Points block at size bytes aligned like the scans, false when the arena is used up
+    bool carve(_u8 *& block, size_t size)
+    {
+        const size_t bytes = _aligned(size);
+        if (_used + bytes > _size) return false;
+
+        block = _base + _used;
+        _used += bytes;
+        return true;
+    }
+
+    /// Bytes allocated
+    size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    RplidarScanArena(const RplidarScanArena &);
+    RplidarScanArena & operator=(const RplidarScanArena &);
+
+    // rounds up so every array of the next scan starts aligned as well
+    static size_t _aligned(size_t capacity)
+    {
+        return (capacity + RplidarScanSoA::ALIGNMENT - 1) & ~(size_t)(RplidarScanSoA::ALIGNMENT - 1);
+    }
+
+    _u8 *   _block;
+    _u8 *   _base;      // _block rounded up to ALIGNMENT
+    size_t  _size;
+    size_t  _used;
+};
+
+/// Owner of the buffers handed out through RplidarScanLease
+class RplidarScanPool
+{
+public:
+    virtual void addLeaseRef(_u32 index) = 0;
+    virtual void releaseLeaseRef(_u32 index) = 0;
+
+protected:
+    virtual ~RplidarScanPool() {}
+};
+
+/// Reference counted, read only view of a scan held in a driver owned buffer. Copies
+/// share the buffer, it goes back to the driver when the last of them is released or
+/// destroyed. All leases have to be released before the driver is disposed.
+class RplidarScanLease
+{
+public:
+    RplidarScanLease()
+        : _pool(NULL), _index(0), _scan(NULL)
+    {
+    }
+
+    /// Adopts one reference the pool has already counted for index
+    RplidarScanLease(RplidarScanPool * pool, _u32 index, const RplidarScanSoA * scan)
+        : _pool(pool), _index(index), _scan(scan)
+    {
+    }
+
+    RplidarScanLease(const RplidarScanLease & other)
+        : _pool(other._pool), _index(other._index), _scan(other._scan)
+    {
+        if (_pool) _pool->addLeaseRef(_index);
+    }
+
+    RplidarScanLease & operator=(const RplidarScanLease & other)
+    {
+        if (other._pool) other._pool->addLeaseRef(other._index);
+        release();
+        _pool = other._pool;
+        _index = other._index;
+        _scan = other._scan;
+        return *this;
+    }
+
+    RplidarScanLease(RplidarScanLease && other)
+        : _pool(other._pool), _index(other._index), _scan(other._scan)
+    {
+        other._pool = NULL;
+        other._scan = NULL;
+    }
+
+    RplidarScanLease & operator=(RplidarScanLease && other)
+    {
+        if (this != &other) {
+            release();
+            _pool = other._pool;
+            _index = other._index;
+            _scan = other._scan;
+            other._pool = NULL;
+            other._scan = NULL;
+        }
+        return *this;
+    }
+
+    ~RplidarScanLease()
+    {
+        release();
+    }
+
+    void release()
+    {
+        if (_pool) _pool->releaseLeaseRef(_index);
+        _pool = NULL;
+        _scan = NULL;
+    }
+
+    bool valid() const { return _scan != NULL; }
+    const RplidarScanSoA & operator*() const { return *_scan; }
+    const RplidarScanSoA * operator->() const { return _scan; }
+
+protected:
+    RplidarScanPool *        _pool;
+    _u32                     _index;
+    const RplidarScanSoA *   _scan;
+};
+
+enum {
+    SCAN_QUEUE_DROP_OLDEST = 0x0, // a full queue gives up its oldest scan for the new one
+    SCAN_QUEUE_DROP_NEWEST = 0x1, // a full queue throws the new scan away
+};
+
+enum {
+    SCAN_GRID_NEAREST   = 0x0, // a bin keeps the node closest to its centre
+    SCAN_GRID_MIN_RANGE = 0x1, // a bin keeps its closest obstacle
+    SCAN_GRID_MEAN      = 0x2, // a bin averages the distance of all its nodes
+};
+
 enum {
     DRIVER_TYPE_SERIALPORT = 0x0,
     DRIVER_TYPE_TCP = 0x1,
+    DRIVER_TYPE_SERIALPORT_IOURING = 0x2,
+    DRIVER_TYPE_REPLAY = 0x3,
 };
 
 class ChannelDevice
 {
 public:
+    virtual ~ChannelDevice() {}
     virtual bool bind(const char*, uint32_t ) = 0;
     virtual bool open() {return true;}
     virtual void close() = 0;
@@ -78,6 +325,9 @@ public:
     virtual void setDTR() {return;}
     virtual void clearDTR() {return;}
     virtual void ReleaseRxTx() {return;}
+    // CLOCK_MONOTONIC microseconds the last byte recvdata() handed out arrived at, 0 when
+    // the channel doesn't keep track of it
+    virtual _u64 arrivalUs() {return 0;}
 };
 
 class RPlidarDriver {
@@ -88,12 +338,21 @@ public:
 
     enum {
         MAX_SCAN_NODES = 8192,
+        MIN_SCAN_NODES = 128,   // a power of 2 that holds any decoded frame
+    };
+
+    enum {
+        MAX_SCAN_LEASES = 2,
     };
 
     enum {
         LEGACY_SAMPLE_DURATION = 476,
     };
 
+    enum {
+        DEFAULT_MIN_SCAN_RPM = 120,
+    };
+
 public:
     /// Create an RPLIDAR Driver Instance
     /// This interface should be invoked first before any other operations
@@ -287,6 +546,27 @@ public:
     /// \The caller application can set the timeout value to Zero(0) to make this interface always returns immediately to achieve non-block operation.
     virtual u_result grabScanDataHq(rplidar_response_measurement_node_hq_t * nodebuffer, size_t & count, _u32 timeout = DEFAULT_TIMEOUT) = 0;
 
+    /// Same as grabScanDataHq(rplidar_response_measurement_node_hq_t*, size_t&, _u32) but hands the
+    /// scan out in structure-of-arrays form. The driver keeps the scan in this form, so it is
+    /// copied array by array without repacking.
+    ///
+    /// \param scan           Arrays provided by the caller application. At most scan.capacity nodes are
+    ///                       stored, scan.count is set to the actual received data count.
+    ///
+    /// \param timeout        Max duration allowed to wait for a complete scan data.
+    virtual u_result grabScanDataHq(RplidarScanSoA & scan, _u32 timeout = DEFAULT_TIMEOUT) = 0;
+
+    /// Same as grabScanDataHq(RplidarScanSoA&, _u32) without any copy: the lease refers to the
+    /// driver's own buffer of the scan. Up to MAX_SCAN_LEASES buffers can be leased at a time,
+    /// copies of a lease share its buffer.
+    ///
+    /// \param lease          Receives the scan, a scan it held before is released.
+    ///
+    /// \param timeout        Max duration allowed to wait for a complete scan data.
+    ///
+    /// The interface will return RESULT_INSUFFICIENT_MEMORY when MAX_SCAN_LEASES buffers are leased already.
+    virtual u_result grabScanLease(RplidarScanLease & lease, _u32 timeout = DEFAULT_TIMEOUT) = 0;
+
     /// Ascending the scan data according to the angle value in the scan.
     ///
     /// \param nodebuffer     Buffer provided by the caller application to do the reorder. Should be retrived from the grabScanData
@@ -305,6 +585,18 @@ public:
     /// The interface will return RESULT_OPERATION_FAIL when all the scan data is invalid. 
     virtual u_result ascendScanData(rplidar_response_measurement_node_hq_t * nodebuffer, size_t count) = 0;
 
+    /// Ascending the scan data according to the angle value in the scan, see
+    /// ascendScanData(rplidar_response_measurement_node_hq_t*, size_t).
+    ///
+    /// \param scan           Scan retrived from grabScanDataHq(RplidarScanSoA&, _u32), at most MAX_SCAN_NODES nodes.
+    ///
+    /// The interface will return RESULT_OPERATION_FAIL when all the scan data is invalid.
+    virtual u_result ascendScanData(RplidarScanSoA & scan) = 0;
+
+    /// Writes the scan in ascending angle order to sorted, which needs room for scan.count nodes.
+    /// The scan itself is left untouched, so it may come from a lease.
+    virtual u_result ascendScanData(const RplidarScanSoA & scan, RplidarScanSoA & sorted) = 0;
+
     /// Return received scan points even if it's not complete scan
     ///
     /// \param nodebuffer     Buffer provided by the caller application to store the scan data
@@ -326,6 +618,80 @@ public:
     /// The interface will return RESULT_REMAINING_DATA to indicate that the given buffer is full, but that there remains data to be read.
     virtual u_result getScanDataWithIntervalHq(rplidar_response_measurement_node_hq_t * nodebuffer, size_t & count) = 0;
 
+    /// Wait for scan points that have been decoded but not read yet and move up to nodes.capacity of them
+    /// to nodes. It returns as soon as the cache thread has decoded a frame, so the caller sees the points
+    /// one capsule at a time instead of one revolution at a time. Shares its data with the overload above.
+    ///
+    /// \param nodes          Points in the order they were measured, including their timestamps
+    ///
+    /// \param timeout        The max duration allowed to wait for new points
+    ///
+    /// The interface will return RESULT_OPERATION_TIMEOUT when no point was decoded within the timeout.
+    /// The interface will return RESULT_REMAINING_DATA to indicate that nodes is full, but that there remains data to be read.
+    virtual u_result getScanDataWithIntervalHq(RplidarScanSoA & nodes, _u32 timeout = DEFAULT_TIMEOUT) = 0;
+
+    /// Nodes queued for and nodes lost to getScanDataWithIntervalHq since the driver was created. Nodes
+    /// are lost when the buffer behind it (at least one revolution) is full because it hasn't been read for a while.
+    virtual void getScanDataWithIntervalStats(_u64 & queued, _u64 & dropped) = 0;
+
+    /// Completed scans wait in a bounded queue until grabScanDataHq picks them up, so a
+    /// consumer that falls behind for a revolution or two gets every scan in order.
+    /// The policy decides which scan is lost once the queue is full.
+    ///
+    /// \param policy         SCAN_QUEUE_DROP_OLDEST (default) or SCAN_QUEUE_DROP_NEWEST
+    virtual u_result setScanQueuePolicy(_u32 policy) = 0;
+
+    /// Scans completed by the background thread and scans lost to a full queue since the driver was created
+    virtual void getScanQueueStats(_u64 & completed, _u64 & dropped) = 0;
+
+    /// The scan buffers hold one revolution at the lowest rotation speed given here (DEFAULT_MIN_SCAN_RPM
+    /// unless set), they are sized from it and the sample duration of the scan mode when a scan is started.
+    /// A slower revolution keeps its latest node in the last slot. The buffers are only resized while no
+    /// scan is taken or leased, getScanDataWithIntervalHq must not be called while a scan is started.
+    virtual void setScanBufferMinRPM(float rpm) = 0;
+
+    /// Most nodes a scan can hold since the last start of a scan, at most MAX_SCAN_NODES
+    virtual size_t getMaxScanNodes() = 0;
+
+    /// Bytes allocated for the scan buffers
+    virtual size_t getScanBufferSize() = 0;
+
+    /// Resamples every revolution onto a fixed angular grid while it is decoded, like the ranges of
+    /// a laser scan, so the scan doesn't have to be sorted and binned again afterwards. Only takes
+    /// effect when the next scan is started.
+    ///
+    /// \param bins           Bins per revolution, e.g. 360, 720 or 1440. 0 turns the grid off.
+    ///
+    /// \param policy         Which distance a bin holds when several nodes fall into it: SCAN_GRID_NEAREST
+    ///                       (default), SCAN_GRID_MIN_RANGE or SCAN_GRID_MEAN
+    ///
+    /// The interface will return RESULT_INVALID_DATA when bins is above MAX_SCAN_NODES or the policy is unknown.
+    /// The interface will return RESULT_OPERATION_FAIL while a scan is started.
+    virtual u_result setScanGrid(size_t bins, _u32 policy = SCAN_GRID_NEAREST) = 0;
+
+    /// Wait for a revolution resampled by setScanGrid that hasn't been grabbed yet. Only the latest
+    /// revolution is kept, a slow caller misses the ones before. One thread at a time.
+    ///
+    /// \param grid           Arrays provided by the caller application with room for grid.bins bins,
+    ///                       grid.bins is set to the bins of the grid on return.
+    ///
+    /// \param timeout        Max duration allowed to wait for a complete revolution.
+    ///
+    /// The interface will return RESULT_OPERATION_NOT_SUPPORT when no grid was set.
+    /// The interface will return RESULT_INSUFFICIENT_MEMORY when grid has fewer bins than setScanGrid was given.
+    virtual u_result grabScanGrid(RplidarScanGrid & grid, _u32 timeout = DEFAULT_TIMEOUT) = 0;
+
+    /// Rotation speed estimated from how fast the angle of the decoded frames has moved on in roughly
+    /// the last 100 ms of host time. It is updated with every frame, several times per revolution.
+    ///
+    /// \param rpm            Revolutions per minute
+    ///
+    /// \param timestamp_us   Host time (CLOCK_MONOTONIC, microseconds) of the newest node the estimate
+    ///                       includes, tells how fresh it is
+    ///
+    /// The interface will return RESULT_OPERATION_FAIL before the first estimate.
+    virtual u_result getRotationSpeed(float & rpm, _u64 & timestamp_us) = 0;
+
     virtual ~RPlidarDriver() {}
 protected:
     RPlidarDriver(){}
@@ -40,6 +40,7 @@ namespace rp { namespace standalone{ namespace rplidar {
 public:
     enum {
         RPLIDAR_TOF_MINUM_MAJOR_ID = 5,
+        RPLIDAR_SYNC_BUFFER_SIZE = 512, // holds more than two of the largest capsules
     };
 
     virtual bool isConnected();     
@@ -76,10 +77,24 @@ public:
     virtual u_result stop(_u32 timeout = DEFAULT_TIMEOUT);
     virtual u_result grabScanData(rplidar_response_measurement_node_t * nodebuffer, size_t & count, _u32 timeout = DEFAULT_TIMEOUT);
     virtual u_result grabScanDataHq(rplidar_response_measurement_node_hq_t * nodebuffer, size_t & count, _u32 timeout = DEFAULT_TIMEOUT);
+    virtual u_result grabScanDataHq(RplidarScanSoA & scan, _u32 timeout = DEFAULT_TIMEOUT);
+    virtual u_result grabScanLease(RplidarScanLease & lease, _u32 timeout = DEFAULT_TIMEOUT);
     virtual u_result ascendScanData(rplidar_response_measurement_node_t * nodebuffer, size_t count);
     virtual u_result ascendScanData(rplidar_response_measurement_node_hq_t * nodebuffer, size_t count);
+    virtual u_result ascendScanData(RplidarScanSoA & scan);
+    virtual u_result ascendScanData(const RplidarScanSoA & scan, RplidarScanSoA & sorted);
     virtual u_result getScanDataWithInterval(rplidar_response_measurement_node_t * nodebuffer, size_t & count);
     virtual u_result getScanDataWithIntervalHq(rplidar_response_measurement_node_hq_t * nodebuffer, size_t & count);
+    virtual u_result getScanDataWithIntervalHq(RplidarScanSoA & nodes, _u32 timeout = DEFAULT_TIMEOUT);
+    virtual u_result setScanQueuePolicy(_u32 policy);
+    virtual void getScanQueueStats(_u64 & completed, _u64 & dropped);
+    virtual void getScanDataWithIntervalStats(_u64 & queued, _u64 & dropped);
+    virtual void setScanBufferMinRPM(float rpm);
+    virtual size_t getMaxScanNodes();
+    virtual size_t getScanBufferSize();
+    virtual u_result setScanGrid(size_t bins, _u32 policy = SCAN_GRID_NEAREST);
+    virtual u_result grabScanGrid(RplidarScanGrid & grid, _u32 timeout = DEFAULT_TIMEOUT);
+    virtual u_result getRotationSpeed(float & rpm, _u64 & timestamp_us);
 
 protected:
 
@@ -87,48 +102,69 @@ protected:
     void     _disableDataGrabbing();
 
     virtual u_result _waitResponseHeader(rplidar_ans_header_t * header, _u32 timeout = DEFAULT_TIMEOUT);
-    virtual u_result _cacheScanData();
     virtual u_result _waitScanData(rplidar_response_measurement_node_t * nodebuffer, size_t & count, _u32 timeout = DEFAULT_TIMEOUT);
     virtual u_result _waitNode(rplidar_response_measurement_node_t * node, _u32 timeout = DEFAULT_TIMEOUT);
-    virtual u_result  _cacheCapsuledScanData();
     virtual u_result _waitCapsuledNode(rplidar_response_capsule_measurement_nodes_t & node, _u32 timeout = DEFAULT_TIMEOUT);
-    virtual void     _capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount);
-    virtual void     _dense_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount);
+    void             _capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & previous, const rplidar_response_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes);
+    void             _dense_capsuleToNormal(const rplidar_response_capsule_measurement_nodes_t & previous, const rplidar_response_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes);
     
     //FW1.23
-    virtual u_result  _cacheUltraCapsuledScanData();
     virtual u_result _waitUltraCapsuledNode(rplidar_response_ultra_capsule_measurement_nodes_t & node, _u32 timeout = DEFAULT_TIMEOUT);
-    virtual void     _ultraCapsuleToNormal(const rplidar_response_ultra_capsule_measurement_nodes_t & capsule, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount);
+    void             _ultraCapsuleToNormal(const rplidar_response_ultra_capsule_measurement_nodes_t & previous, const rplidar_response_ultra_capsule_measurement_nodes_t & capsule, RplidarScanSoA & nodes);
 
-    virtual u_result  _cacheHqScanData();
     virtual u_result _waitHqNode(rplidar_response_hq_capsule_measurement_nodes_t & node, _u32 timeout = DEFAULT_TIMEOUT);
-    virtual void     _HqToNormal(const rplidar_response_hq_capsule_measurement_nodes_t & node_hq, rplidar_response_measurement_node_hq_t *nodebuffer, size_t &nodeCount);
+    void             _HqToNormal(const rplidar_response_hq_capsule_measurement_nodes_t & node_hq, RplidarScanSoA & nodes);
+
+    // The cache thread, one instance per answer type. TScanMode names the frame
+    // type, how to wait for a frame and how to decode it against the previous one.
+    struct StandardScanMode;
+    struct CapsuleScanMode;
+    struct DenseCapsuleScanMode;
+    struct UltraCapsuleScanMode;
+    struct HqScanMode;
+    template <class TScanMode> u_result _cacheScanData();
+
+    u_result _waitSyncedFrame(_u8 * frame, size_t frameSize, bool isHqFrame, _u32 timeout);
+    void     _sizeScanBuffers();
+    float    _standardSampleDuration();
 
     bool     _isConnected; 
     bool     _isScanning;
     bool     _isSupportingMotorCtrl;
     bool     _isTofLidar;
-    rplidar_response_measurement_node_hq_t   _cached_scan_node_hq_buf[8192];
-    size_t                                   _cached_scan_node_hq_count;
+    ScanQueue                                _scanQueue;
 
-    rplidar_response_measurement_node_hq_t   _cached_scan_node_hq_buf_for_interval_retrieve[8192];
-    size_t                                   _cached_scan_node_hq_count_for_interval_retrieve;
+    IntervalRing                             _intervalRing;
+    ScanGrid                                 _scanGrid;
+    RotationEstimator                        _rotation;
+
+    // the scan queue, the interval ring and the sort scratch live in here, sized by _sizeScanBuffers()
+    RplidarScanArena                         _scanArena;
+    float                                    _minScanRpm;
+    size_t                                   _maxScanNodes;
+    _u8 *                                    _sortScratch;      // for _maxScanNodes nodes, see _SortScratch
+    bool                                     _sortScratchBusy;  // set while a sort holds _sortScratch
 
     _u16                    _cached_sampleduration_std;
     _u16                    _cached_sampleduration_express;
-    _u8                     _cached_express_flag;
+    float                   _sampleDurationUs;  // of the running scan mode, spaces the node timestamps
+    float                   _stdSampleDurationUs; // of the standard scan mode, 0 until looked up on this connection
 
-    rplidar_response_capsule_measurement_nodes_t _cached_previous_capsuledata;
-    rplidar_response_dense_capsule_measurement_nodes_t _cached_previous_dense_capsuledata;
-    rplidar_response_ultra_capsule_measurement_nodes_t _cached_previous_ultracapsuledata;
-    rplidar_response_hq_capsule_measurement_nodes_t _cached_previous_Hqdata;
     bool                                         _is_previous_capsuledataRdy;
     bool                                         _is_previous_HqdataRdy;
 
+    // bytes received by _waitSyncedFrame but not yet consumed, a failed frame candidate
+    // is searched again from its second byte instead of being thrown away
+    _u8                     _syncBuffer[RPLIDAR_SYNC_BUFFER_SIZE];
+    size_t                  _syncBufferPos;
+    size_t                  _syncBufferLen;
+    _u64                    _syncBufferArrivalUs; // when the last byte in _syncBuffer was received
+    _u64                    _frameArrivalUs;    // when the bytes completing the last frame were received
+    float                   _usPerByte;         // line time of a byte, 0 on links without a line rate
+
 	
 
     rp::hal::Locker         _lock;
-    rp::hal::Event          _dataEvt;
     rp::hal::Thread _cachethread;
 
 protected:
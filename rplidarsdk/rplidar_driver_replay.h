@@ -0,0 +1,328 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2019 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; 
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+
+namespace rp { namespace standalone{ namespace rplidar {
+
+// Plays back a file holding the raw bytes a device sent from connect() on.
+// Every command that expects an answer skips forward to the next answer
+// descriptor in the recording, STOP and RESET mute the stream until the
+// next command, so the unchanged parsers and cache loops see the same byte
+// sequence the device delivered. Captures written by RPlidarDriverSerial::startCapture
+// are released at their recorded arrival times, plain byte dumps at the line
+// rate given to bind(), both scaled by the replay speed, or at once with
+// REPLAY_SPEED_FASTEST.
+class ReplayChannelDevice :public ChannelDevice
+{
+public:
+    enum {
+        EOF_WAIT_MAX = 100, // ms, how long a wait past the end of the recording blocks
+    };
+
+    ReplayChannelDevice()
+        : _pos(0), _holding(true), _exhausted(false), _payloadCalls(0)
+        , _bytesPerSec(11520), _speed(1.0f), _paceStartMs(0), _paceStartPos(0)
+        , _closePending(false), _wakeEvt(false, false)
+    {}
+
+    bool bind(const char * path, uint32_t baudrate)
+    {
+        _data.clear();
+        _chunkEnd.clear();
+        _chunkTs.clear();
+        FILE * fp = fopen(path, "rb");
+        if (!fp) return false;
+
+        std::vector<_u8> raw;
+        _u8 chunk[4096];
+        size_t len;
+        while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            raw.insert(raw.end(), chunk, chunk + len);
+        }
+        fclose(fp);
+
+        if (raw.size() >= sizeof(rp::hal::rx_capture::capture_file_header_t)
+            && !memcmp(&raw[0], rp::hal::rx_capture::Magic(), 8)) {
+            _loadCapture(raw);
+        } else {
+            _data.swap(raw);
+        }
+
+        // 8N1: ten bits on the wire per byte
+        _bytesPerSec = baudrate ? baudrate / 10 : 11520;
+        _pos = 0;
+        _holding = true;
+        __atomic_store_n(&_exhausted, false, __ATOMIC_RELAXED);
+        _payloadCalls = 0;
+        _closePending = false;
+        _wakeEvt.set(false);
+        return !_data.empty();
+    }
+    void close()
+    {
+        _closePending = true;
+        _wakeEvt.set();
+    }
+    bool waitfordata(size_t data_count,_u32 timeout = -1, size_t * returned_size = NULL)
+    {
+        size_t length = 0;
+        if (returned_size == NULL) returned_size = &length;
+        *returned_size = 0;
+
+        if (_closePending) return false;
+
+        size_t remaining = _holding ? 0 : _data.size() - _pos;
+        if (remaining < data_count) {
+            // nothing more is coming: behave like a silent device
+            if (!_holding) __atomic_store_n(&_exhausted, true, __ATOMIC_RELAXED);
+            _wakeEvt.wait(timeout < EOF_WAIT_MAX ? timeout : EOF_WAIT_MAX);
+            return false;
+        }
+
+        if (_speed > 0) {
+            // the time at which the last requested byte has been "received"
+            double due = _dueMs(_pos + data_count);
+            _u32 now = getms();
+            if (due > now) {
+                _u32 delayMs = (_u32)(due - now + 0.5);
+                if (delayMs > timeout) {
+                    _wakeEvt.wait(timeout);
+                    return false;
+                }
+                if (delayMs && _wakeEvt.wait(delayMs) == rp::hal::Event::EVENT_OK) return false;
+            }
+            size_t released = _releasedAt(getms());
+            *returned_size = released > _pos ? released - _pos : 0;
+            if (*returned_size < data_count) *returned_size = data_count;
+        } else {
+            *returned_size = remaining;
+        }
+        return true;
+    }
+    int senddata(const _u8 * data, size_t size)
+    {
+        if (_payloadCalls) {
+            // size byte, payload and checksum of the previous command
+            --_payloadCalls;
+            return (int)size;
+        }
+        if (size >= 2 && data[0] == RPLIDAR_CMD_SYNC_BYTE) {
+            _u8 cmd = data[1];
+            if (cmd & RPLIDAR_CMDFLAG_HAS_PAYLOAD) _payloadCalls = 3;
+            _onCommand(cmd);
+        }
+        return (int)size;
+    }
+    int recvdata(unsigned char * data, size_t size)
+    {
+        if (_holding) return 0;
+
+        size_t remaining = _data.size() - _pos;
+        if (size > remaining) size = remaining;
+        memcpy(data, &_data[0] + _pos, size);
+        __atomic_store_n(&_pos, _pos + size, __ATOMIC_RELAXED);
+        return (int)size;
+    }
+
+    // only while the cache thread isn't running, it paces by the speed
+    void setReplaySpeed(float speed)
+    {
+        _speed = speed;
+        _paceStartMs = getms();
+        _paceStartPos = _pos;
+    }
+
+    // any thread, may be polled while the cache thread plays back
+    bool isReplayFinished()
+    {
+        return __atomic_load_n(&_exhausted, __ATOMIC_RELAXED)
+            || __atomic_load_n(&_pos, __ATOMIC_RELAXED) >= _data.size();
+    }
+
+protected:
+    void _loadCapture(const std::vector<_u8> & raw)
+    {
+        typedef rp::hal::rx_capture::capture_file_header_t file_header_t;
+        typedef rp::hal::rx_capture::capture_record_t record_t;
+        const size_t align = rp::hal::rx_capture::CAPTURE_RECORD_ALIGN;
+
+        // segments may have been concatenated into one file
+        size_t offset = 0;
+        while (offset + sizeof(record_t) <= raw.size()) {
+            if (!memcmp(&raw[offset], rp::hal::rx_capture::Magic(), 8)) {
+                file_header_t header;
+                memcpy(&header, &raw[offset], sizeof(header));
+                offset += header.header_size;
+                continue;
+            }
+
+            record_t record;
+            memcpy(&record, &raw[offset], sizeof(record));
+            if (!record.length) {
+                // preallocated tail of a segment that was not finished, go to the next one
+                offset += align;
+                while (offset + 8 <= raw.size() && memcmp(&raw[offset], rp::hal::rx_capture::Magic(), 8)) offset += align;
+                continue;
+            }
+            if (offset + sizeof(record) + record.length > raw.size()) break;
+
+            const _u8 * payload = &raw[offset + sizeof(record)];
+            _data.insert(_data.end(), payload, payload + record.length);
+            _chunkEnd.push_back(_data.size());
+            _chunkTs.push_back(record.timestamp_ns);
+            offset += sizeof(record) + ((record.length + align - 1) & ~(align - 1));
+        }
+    }
+
+    size_t _chunkOf(size_t pos)
+    {
+        size_t idx = std::upper_bound(_chunkEnd.begin(), _chunkEnd.end(), pos) - _chunkEnd.begin();
+        return idx < _chunkEnd.size() ? idx : _chunkEnd.size() - 1;
+    }
+
+    // getms() by which the data up to endPos has arrived at the current speed
+    double _dueMs(size_t endPos)
+    {
+        if (_chunkTs.empty()) {
+            return _paceStartMs + (double)(endPos - _paceStartPos) * 1000.0 / (_bytesPerSec * _speed);
+        }
+        _u64 startTs = _chunkTs[_chunkOf(_paceStartPos)];
+        _u64 endTs = _chunkTs[_chunkOf(endPos - 1)];
+        return _paceStartMs + (endTs > startTs ? endTs - startTs : 0) / 1e6 / _speed;
+    }
+
+    // end of the data that has arrived by getms() == now
+    size_t _releasedAt(_u32 now)
+    {
+        if (_chunkTs.empty()) {
+            size_t released = _paceStartPos + (size_t)((now - _paceStartMs) * (double)(_bytesPerSec * _speed) / 1000.0);
+            return released < _data.size() ? released : _data.size();
+        }
+        _u64 limit = _chunkTs[_chunkOf(_paceStartPos)] + (_u64)((now - _paceStartMs) * 1e6 * _speed);
+        size_t idx = std::upper_bound(_chunkTs.begin(), _chunkTs.end(), limit) - _chunkTs.begin();
+        return idx ? _chunkEnd[idx - 1] : 0;
+    }
+
+    void _onCommand(_u8 cmd)
+    {
+        size_t next = _findDescriptor(_pos);
+
+        if (cmd == RPLIDAR_CMD_STOP || cmd == RPLIDAR_CMD_RESET) {
+            // the device goes quiet, whatever it streamed is skipped
+            __atomic_store_n(&_pos, next, __ATOMIC_RELAXED);
+            _holding = true;
+            return;
+        }
+
+        // a recording without any (further) descriptor is played back as it is
+        if (next < _data.size()) __atomic_store_n(&_pos, next, __ATOMIC_RELAXED);
+        _holding = false;
+        _paceStartMs = getms();
+        _paceStartPos = _pos;
+    }
+
+    size_t _findDescriptor(size_t from)
+    {
+        for (size_t pos = from; pos + sizeof(rplidar_ans_header_t) <= _data.size(); ++pos) {
+            if (_data[pos] != RPLIDAR_ANS_SYNC_BYTE1 || _data[pos+1] != RPLIDAR_ANS_SYNC_BYTE2) continue;
+
+            const rplidar_ans_header_t * header = reinterpret_cast<const rplidar_ans_header_t *>(&_data[pos]);
+            _u32 size = header->size_q30_subtype & RPLIDAR_ANS_HEADER_SIZE_MASK;
+            // reject sync patterns inside measurement data
+            if (size > 1024) continue;
+            switch (header->type) {
+            case RPLIDAR_ANS_TYPE_DEVINFO:
+            case RPLIDAR_ANS_TYPE_DEVHEALTH:
+            case RPLIDAR_ANS_TYPE_MEASUREMENT:
+            case RPLIDAR_ANS_TYPE_MEASUREMENT_CAPSULED:
+            case RPLIDAR_ANS_TYPE_MEASUREMENT_HQ:
+            case RPLIDAR_ANS_TYPE_SAMPLE_RATE:
+            case RPLIDAR_ANS_TYPE_MEASUREMENT_CAPSULED_ULTRA:
+            case RPLIDAR_ANS_TYPE_GET_LIDAR_CONF:
+            case RPLIDAR_ANS_TYPE_SET_LIDAR_CONF:
+            case RPLIDAR_ANS_TYPE_MEASUREMENT_DENSE_CAPSULED:
+            case RPLIDAR_ANS_TYPE_ACC_BOARD_FLAG:
+                return pos;
+            }
+        }
+        return _data.size();
+    }
+
+    std::vector<_u8> _data;
+    std::vector<size_t> _chunkEnd;  // captures only: end offset in _data of each received chunk
+    std::vector<_u64>   _chunkTs;   // and its CLOCK_MONOTONIC arrival time in ns
+    size_t _pos;           // written by the thread reading, atomically for isReplayFinished()
+    bool   _holding;       // muted after STOP until the next command
+    bool   _exhausted;     // a wait ran past the end of the recording, atomic as _pos
+    int    _payloadCalls;  // senddata() calls still belonging to the last command
+
+    _u32   _bytesPerSec;
+    float  _speed;
+    _u32   _paceStartMs;
+    size_t _paceStartPos;
+
+    bool   _closePending;
+    rp::hal::Event _wakeEvt;
+};
+
+
+class RPlidarDriverReplay : public RPlidarDriverImplCommon
+{
+public:
+    enum {
+        REPLAY_SPEED_FASTEST = 0,
+        REPLAY_SPEED_REALTIME = 1,
+    };
+
+    RPlidarDriverReplay();
+    virtual ~RPlidarDriverReplay();
+    /// Opens the recording at file_path, baudrate is the line rate it was recorded at
+    virtual u_result connect(const char * file_path, _u32 baudrate, _u32 flag = 0);
+    virtual void disconnect();
+
+    /// Sets the playback speed as a multiple of the recorded line rate,
+    /// REPLAY_SPEED_FASTEST hands out the data as fast as it is consumed
+    ///
+    /// The interface will return RESULT_OPERATION_FAIL while scanning, stop() first.
+    u_result setReplaySpeed(float speed);
+
+    /// Returns true once the driver has asked for more than the recording holds
+    bool isReplayFinished();
+};
+
+}}}
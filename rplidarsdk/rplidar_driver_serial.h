@@ -39,18 +39,25 @@ namespace rp { namespace standalone{ namespace rplidar {
 class SerialChannelDevice :public ChannelDevice
 {
 public:
+    enum {
+        RX_RING_SIZE = 4096, // must be a power of 2
+    };
+
     rp::hal::serial_rxtx  * _rxtxSerial;
     bool _closePending;
 
-    SerialChannelDevice():_rxtxSerial(rp::hal::serial_rxtx::CreateRxTx()){}
+    SerialChannelDevice(_u32 rxtxType = rp::hal::serial_rxtx::RXTX_TYPE_DEFAULT):_rxtxSerial(rp::hal::serial_rxtx::CreateRxTx(rxtxType)),_rxHead(0),_rxTail(0),_rxArrivalUs(0),_usPerByte(0),_capture(NULL),_captureBusy(false){}
 
     bool bind(const char * portname, uint32_t baudrate)
     {
         _closePending = false;
+        _rxHead = _rxTail = 0;
+        _usPerByte = baudrate ? 10e6f / baudrate : 0; // 8N1
         return _rxtxSerial->bind(portname, baudrate);
     }
     bool open()
     {
+        _rxHead = _rxTail = 0;
         return _rxtxSerial->open();
     }
     void close()
@@ -61,12 +68,30 @@ public:
     }
     void flush()
     {
+        _rxHead = _rxTail = 0;
         _rxtxSerial->flush(0);
     }
     bool waitfordata(size_t data_count,_u32 timeout = -1, size_t * returned_size = NULL)
     {
         if (_closePending) return false;
-        return (_rxtxSerial->waitfordata(data_count, timeout, returned_size) == rp::hal::serial_rxtx::ANS_OK);
+
+        // serve the request from the bytes drained by an earlier read if possible,
+        // otherwise wait for the missing part and drain the whole tty queue at once
+        size_t buffered = _rxTail - _rxHead;
+        if (buffered < data_count) {
+            if (_rxtxSerial->waitfordata(data_count - buffered, timeout) != rp::hal::serial_rxtx::ANS_OK) {
+                if (returned_size) *returned_size = 0;
+                return false;
+            }
+            // more than one read is only needed when the free space wraps around the
+            // ring end, or when the tty hands out a large VMIN in 64 byte pieces
+            while (buffered < data_count) {
+                if (!_fillRxRing()) break;
+                buffered = _rxTail - _rxHead;
+            }
+        }
+        if (returned_size) *returned_size = buffered;
+        return true;
     }
     int senddata(const _u8 * data, size_t size)
     {
@@ -74,9 +99,25 @@ public:
     }
     int recvdata(unsigned char * data, size_t size)
     {
-        size_t lenRec = 0;
-        lenRec = _rxtxSerial->recvdata(data, size);
-        return lenRec;
+        if (_rxTail == _rxHead) _fillRxRing();
+
+        size_t buffered = _rxTail - _rxHead;
+        if (size > buffered) size = buffered;
+
+        size_t headPos = _rxHead & (RX_RING_SIZE - 1);
+        size_t firstPart = RX_RING_SIZE - headPos;
+        if (firstPart > size) firstPart = size;
+
+        memcpy(data, _rxRing + headPos, firstPart);
+        memcpy(data + firstPart, _rxRing, size - firstPart);
+        _rxHead += size;
+        return (int)size;
+    }
+    _u64 arrivalUs()
+    {
+        // the bytes still in the ring came in after the ones handed out
+        if (!_rxArrivalUs) return 0;
+        return _rxArrivalUs - (_u64)((_rxTail - _rxHead) * _usPerByte + 0.5f);
     }
     void setDTR()
     {
@@ -88,19 +129,96 @@ public:
     }
     void ReleaseRxTx()
     {
+        stopCapture();
         rp::hal::serial_rxtx::ReleaseRxTx(_rxtxSerial);
     }
+
+    bool startCapture(const char * basepath, size_t segment_size)
+    {
+        stopCapture();
+
+        rp::hal::rx_capture * capture = rp::hal::rx_capture::CreateCapture();
+        if (!capture) return false;
+        if (!capture->open(basepath, segment_size)) {
+            rp::hal::rx_capture::ReleaseCapture(capture);
+            return false;
+        }
+        __atomic_store_n(&_capture, capture, __ATOMIC_RELEASE);
+        return true;
+    }
+    void stopCapture()
+    {
+        rp::hal::rx_capture * capture = __atomic_exchange_n(&_capture, (rp::hal::rx_capture *)NULL, __ATOMIC_SEQ_CST);
+        if (!capture) return;
+
+        // let an append that already picked up the pointer finish
+        while (__atomic_load_n(&_captureBusy, __ATOMIC_SEQ_CST)) delay(1);
+        rp::hal::rx_capture::ReleaseCapture(capture);
+    }
+    rp::hal::rx_capture * getCapture()
+    {
+        return __atomic_load_n(&_capture, __ATOMIC_ACQUIRE);
+    }
+
+protected:
+    // drain as much as the tty hands out with a single read, returns the byte count
+    size_t _fillRxRing()
+    {
+        if (_rxTail == _rxHead) _rxHead = _rxTail = 0;
+
+        size_t tailPos = _rxTail & (RX_RING_SIZE - 1);
+        size_t space = RX_RING_SIZE - (_rxTail - _rxHead);
+        size_t contiguous = RX_RING_SIZE - tailPos;
+        if (contiguous > space) contiguous = space;
+        if (!contiguous) return 0;
+
+        int ans = _rxtxSerial->recvdata(_rxRing + tailPos, contiguous);
+        if (ans <= 0) return 0;
+        _rxTail += ans;
+        // one clock read per drain, shared by the frame timestamps and the capture
+        _rxArrivalUs = getus();
+
+        if (__atomic_load_n(&_capture, __ATOMIC_RELAXED)) _teeCapture(_rxRing + tailPos, ans);
+        return ans;
+    }
+
+    void _teeCapture(const _u8 * data, size_t size)
+    {
+        __atomic_store_n(&_captureBusy, true, __ATOMIC_SEQ_CST);
+        rp::hal::rx_capture * capture = __atomic_load_n(&_capture, __ATOMIC_SEQ_CST);
+        if (capture) capture->append(data, size, _rxArrivalUs);
+        __atomic_store_n(&_captureBusy, false, __ATOMIC_RELEASE);
+    }
+
+    _u8    _rxRing[RX_RING_SIZE];
+    size_t _rxHead; // free running read counter
+    size_t _rxTail; // free running write counter
+    _u64   _rxArrivalUs; // when the last drain returned
+    float  _usPerByte;   // line time of a byte
+
+    rp::hal::rx_capture * _capture;
+    bool   _captureBusy; // set while the receiving thread is inside _capture
 };
 
 class RPlidarDriverSerial : public RPlidarDriverImplCommon
 {
 public:
 
-    RPlidarDriverSerial();
+    RPlidarDriverSerial(_u32 rxtxType = rp::hal::serial_rxtx::RXTX_TYPE_DEFAULT);
     virtual ~RPlidarDriverSerial();
     virtual u_result connect(const char * port_path,  _u32 baudrate, _u32 flag = 0);
     virtual void disconnect();
 
+    /// Records every chunk received from the device, with its CLOCK_MONOTONIC arrival
+    /// time, to <basepath>_0000.rpcap, <basepath>_0001.rpcap, ... of segment_size bytes
+    /// each (0 selects 64MB). The files can be played back with RPlidarDriverReplay.
+    u_result startCapture(const char * basepath, size_t segment_size = 0);
+
+    /// Finishes the capture and flushes the files
+    void stopCapture();
+
+    /// Bytes written to and lost from the capture since it has been started
+    void getCaptureStats(_u64 & captured, _u64 & dropped);
 };
 
 }}}
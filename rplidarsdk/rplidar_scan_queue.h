@@ -0,0 +1,687 @@
+/*
+ *  RPLIDAR SDK
+ *
+ *  Copyright (c) 2009 - 2014 RoboPeak Team
+ *  http://www.robopeak.com
+ *  Copyright (c) 2014 - 2019 Shanghai Slamtec Co., Ltd.
+ *  http://www.slamtec.com
+ *
+ */
+/*
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; 
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR 
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#pragma once
+
+namespace rp { namespace standalone{ namespace rplidar {
+
+// Hands completed scans from the cache thread to grabScanDataHq without a lock.
+// The scans live in a fixed set of buffers carved out of the driver's arena, a ring of DEPTH buffer indices carries
+// them from the producer to the consumer and a free list returns them. The
+// producer only ever does atomic loads, stores and CAS operations: when the ring
+// is full it either takes the oldest entry back itself (SCAN_QUEUE_DROP_OLDEST)
+// or keeps refilling the scan it just completed (SCAN_QUEUE_DROP_NEWEST).
+// A buffer taken by the consumer is reference counted and may be leased out, it
+// returns to the free list with its last reference from whichever thread drops it.
+class ScanQueue : public RplidarScanPool
+{
+public:
+    enum {
+        DEPTH   = 3,            // completed scans held for the consumer
+        LEASES  = RPlidarDriver::MAX_SCAN_LEASES,
+        BUFFERS = DEPTH + LEASES + 1, // plus the ones taken by the consumer and the one being filled
+        NO_BUFFER = 0xFFFFFFFF,
+    };
+
+    ScanQueue()
+        : _policy(SCAN_QUEUE_DROP_OLDEST), _completed(0), _dropped(0), _taken(0)
+    {
+        memset(_buffers, 0, sizeof(_buffers));
+        _reset();
+    }
+
+    // points every buffer at room for capacity nodes in arena and empties the queue, only
+    // while the producer is stopped and no buffer is taken by the consumer
+    bool carve(RplidarScanArena & arena, size_t capacity)
+    {
+        for (_u32 pos = 0; pos < BUFFERS; ++pos) {
+            if (!arena.carve(_buffers[pos], capacity)) return false;
+        }
+        _reset();
+        return true;
+    }
+
+    // buffers taken by the consumer or waited for in acquire()
+    bool taken() const
+    {
+        return __atomic_load_n(&_taken, __ATOMIC_ACQUIRE) != 0;
+    }
+
+    void setDropPolicy(_u32 policy)
+    {
+        __atomic_store_n(&_policy, policy, __ATOMIC_RELAXED);
+    }
+
+    void getStats(_u64 & completed, _u64 & dropped) const
+    {
+        completed = __atomic_load_n(&_completed, __ATOMIC_RELAXED);
+        dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+    }
+
+    // producer: the buffer the next scan is collected in
+    RplidarScanSoA & fillBuffer()
+    {
+        return _buffers[_fill];
+    }
+
+    // producer: queues the filled buffer, fillBuffer() is a fresh one afterwards
+    void publish()
+    {
+        RplidarScanSoA & scan = _buffers[_fill];
+        scan.seq = _completed;
+        __atomic_store_n(&_completed, _completed + 1, __ATOMIC_RELAXED);
+
+        _u64 head = _head;
+        for (;;) {
+            _u64 tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+            if (head - tail < DEPTH) break;
+
+            if (__atomic_load_n(&_policy, __ATOMIC_RELAXED) == SCAN_QUEUE_DROP_NEWEST) {
+                __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+                return;
+            }
+            _u32 oldest = __atomic_load_n(&_ring[tail % DEPTH], __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&_tail, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&_dropped, _dropped + 1, __ATOMIC_RELAXED);
+                release(oldest);
+                break;
+            }
+            // lost against the consumer, which made room
+        }
+
+        __atomic_store_n(&_ring[head % DEPTH], _fill, __ATOMIC_RELAXED);
+        __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+        _readyEvt.publish();
+
+        // the ring, the consumer and the producer never hold more than BUFFERS - 1 buffers
+        _fill = _popFree();
+    }
+
+    // consumer: takes the oldest queued scan with one reference, the buffer goes back
+    // to the free list once releaseLeaseRef() dropped the last one
+    u_result acquire(_u32 & index, _u32 timeout)
+    {
+        // at most LEASES buffers are out, so the producer always finds a free one
+        _u32 taken = __atomic_load_n(&_taken, __ATOMIC_RELAXED);
+        do {
+            if (taken >= LEASES) return RESULT_INSUFFICIENT_MEMORY;
+        } while (!__atomic_compare_exchange_n(&_taken, &taken, taken + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+        for (;;) {
+            _u32 seen = _readyEvt.sequence();
+            _u64 tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+            if (tail != __atomic_load_n(&_head, __ATOMIC_ACQUIRE)) {
+                index = __atomic_load_n(&_ring[tail % DEPTH], __ATOMIC_RELAXED);
+                if (__atomic_compare_exchange_n(&_tail, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    __atomic_store_n(&_refs[index], 1, __ATOMIC_RELAXED);
+                    return RESULT_OK;
+                }
+                continue;
+            }
+
+            switch ((int)_readyEvt.wait(seen, timeout))
+            {
+            case rp::hal::SeqEvent::EVENT_OK:
+                break;
+            case rp::hal::SeqEvent::EVENT_TIMEOUT:
+                __atomic_sub_fetch(&_taken, 1, __ATOMIC_RELEASE);
+                return RESULT_OPERATION_TIMEOUT;
+            default:
+                __atomic_sub_fetch(&_taken, 1, __ATOMIC_RELEASE);
+                return RESULT_OPERATION_FAIL;
+            }
+        }
+    }
+
+    const RplidarScanSoA & buffer(_u32 index) const
+    {
+        return _buffers[index];
+    }
+
+    virtual void addLeaseRef(_u32 index)
+    {
+        __atomic_add_fetch(&_refs[index], 1, __ATOMIC_RELAXED);
+    }
+
+    virtual void releaseLeaseRef(_u32 index)
+    {
+        if (__atomic_sub_fetch(&_refs[index], 1, __ATOMIC_ACQ_REL)) return;
+        release(index);
+        __atomic_sub_fetch(&_taken, 1, __ATOMIC_RELEASE);
+    }
+
+protected:
+    void _reset()
+    {
+        _head = _tail = 0;
+        _freeTop = NO_BUFFER;
+        for (_u32 pos = 1; pos < BUFFERS; ++pos) {
+            _refs[pos] = 0;
+            release(pos);
+        }
+        _refs[0] = 0;
+        _fill = 0;
+    }
+
+    void release(_u32 index)
+    {
+        _u64 top = __atomic_load_n(&_freeTop, __ATOMIC_RELAXED);
+        _u64 next;
+        do {
+            __atomic_store_n(&_freeNext[index], (_u32)top, __ATOMIC_RELAXED);
+            // the upper half counts the updates so a pop can't be fooled by a recycled index
+            next = ((top + (1ULL << 32)) & 0xFFFFFFFF00000000ULL) | index;
+        } while (!__atomic_compare_exchange_n(&_freeTop, &top, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    _u32 _popFree()
+    {
+        _u64 top = __atomic_load_n(&_freeTop, __ATOMIC_ACQUIRE);
+        _u64 next;
+        do {
+            _u32 index = (_u32)top;
+            if (index == NO_BUFFER) return NO_BUFFER;
+            next = ((top + (1ULL << 32)) & 0xFFFFFFFF00000000ULL) | __atomic_load_n(&_freeNext[index], __ATOMIC_RELAXED);
+        } while (!__atomic_compare_exchange_n(&_freeTop, &top, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+        return (_u32)top;
+    }
+
+    RplidarScanSoA _buffers[BUFFERS];
+    _u32    _fill;                  // producer owned
+    _u32    _ring[DEPTH];
+    _u64    _head;                  // written by the producer only
+    _u64    _tail;                  // advanced by the consumer, or by the producer dropping the oldest scan
+    _u64    _freeTop;               // update count << 32 | first free buffer
+    _u32    _freeNext[BUFFERS];
+    _u32    _policy;
+    _u64    _completed;
+    _u64    _dropped;
+    _u32    _refs[BUFFERS];         // references held on buffers taken by the consumer
+    _u32    _taken;                 // buffers taken by the consumer and not yet back in the free list
+    rp::hal::SeqEvent _readyEvt;
+};
+
+// Carries decoded nodes from the cache thread to getScanDataWithIntervalHq. Single
+// producer, single consumer and wait-free on both sides: the producer appends a
+// whole frame and publishes it with one store, the consumer takes what it wants
+// and moves the read position, nothing is ever moved around in the buffer. Nodes
+// that don't fit any more are dropped and counted instead of overwriting the
+// ones the consumer hasn't seen yet.
+class IntervalRing
+{
+public:
+    IntervalRing()
+        : _mask(0), _head(0), _tail(0), _pushed(0), _dropped(0)
+    {
+        memset(&_nodes, 0, sizeof(_nodes));
+    }
+
+    // room for capacity nodes in arena, a power of 2. Drops what is queued, so only while
+    // neither side is running.
+    bool carve(RplidarScanArena & arena, size_t capacity)
+    {
+        if (!arena.carve(_nodes, capacity)) return false;
+        _mask = capacity - 1;
+        _tail = _head;
+        return true;
+    }
+
+    void getStats(_u64 & pushed, _u64 & dropped) const
+    {
+        pushed = __atomic_load_n(&_pushed, __ATOMIC_RELAXED);
+        dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+    }
+
+    // producer
+    void push(const RplidarScanSoA & nodes)
+    {
+        _u64 head = _head;
+        size_t room = _mask + 1 - (size_t)(head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE));
+        size_t count = nodes.count < room ? nodes.count : room;
+
+        size_t headPos = (size_t)head & _mask;
+        size_t firstPart = _mask + 1 - headPos;
+        if (firstPart > count) firstPart = count;
+        _copy(_nodes, headPos, nodes, 0, firstPart);
+        _copy(_nodes, 0, nodes, firstPart, count - firstPart);
+
+        __atomic_store_n(&_head, head + count, __ATOMIC_RELEASE);
+        __atomic_store_n(&_pushed, _pushed + count, __ATOMIC_RELAXED);
+        if (count != nodes.count) __atomic_store_n(&_dropped, _dropped + nodes.count - count, __ATOMIC_RELAXED);
+        if (count) _readyEvt.publish();
+    }
+
+    // consumer: nodes ready to be popped
+    size_t available() const
+    {
+        return (size_t)(__atomic_load_n(&_head, __ATOMIC_ACQUIRE) - _tail);
+    }
+
+    // consumer: waits until there are nodes to pop
+    u_result wait(_u32 timeout)
+    {
+        for (;;) {
+            _u32 seen = _readyEvt.sequence();
+            if (available()) return RESULT_OK;
+
+            switch ((int)_readyEvt.wait(seen, timeout))
+            {
+            case rp::hal::SeqEvent::EVENT_OK:
+                break;
+            case rp::hal::SeqEvent::EVENT_TIMEOUT:
+                return RESULT_OPERATION_TIMEOUT;
+            default:
+                return RESULT_OPERATION_FAIL;
+            }
+        }
+    }
+
+    // consumer: moves up to nodes.capacity nodes to nodes
+    void pop(RplidarScanSoA & nodes)
+    {
+        size_t count = available();
+        if (count > nodes.capacity) count = nodes.capacity;
+
+        size_t tailPos = (size_t)_tail & _mask;
+        size_t firstPart = _mask + 1 - tailPos;
+        if (firstPart > count) firstPart = count;
+        _copy(nodes, 0, _nodes, tailPos, firstPart);
+        _copy(nodes, firstPart, _nodes, 0, count - firstPart);
+        nodes.count = count;
+
+        __atomic_store_n(&_tail, _tail + count, __ATOMIC_RELEASE);
+    }
+
+    // consumer: moves up to maxCount nodes to nodebuffer, returns the count
+    size_t pop(rplidar_response_measurement_node_hq_t * nodebuffer, size_t maxCount)
+    {
+        size_t count = available();
+        if (count > maxCount) count = maxCount;
+
+        size_t tailPos = (size_t)_tail & _mask;
+        for (size_t pos = 0; pos < count; ++pos) {
+            size_t from = (tailPos + pos) & _mask;
+            nodebuffer[pos].angle_z_q14 = _nodes.angle_z_q14[from];
+            nodebuffer[pos].dist_mm_q2 = _nodes.dist_mm_q2[from];
+            nodebuffer[pos].quality = _nodes.quality[from];
+            nodebuffer[pos].flag = _nodes.flag[from];
+        }
+
+        __atomic_store_n(&_tail, _tail + count, __ATOMIC_RELEASE);
+        return count;
+    }
+
+protected:
+    static void _copy(RplidarScanSoA & to, size_t toPos, const RplidarScanSoA & from, size_t fromPos, size_t count)
+    {
+        memcpy(to.angle_z_q14 + toPos, from.angle_z_q14 + fromPos, count * sizeof(_u16));
+        memcpy(to.dist_mm_q2 + toPos, from.dist_mm_q2 + fromPos, count * sizeof(_u32));
+        memcpy(to.quality + toPos, from.quality + fromPos, count);
+        memcpy(to.flag + toPos, from.flag + fromPos, count);
+        if (to.timestamp_us) memcpy(to.timestamp_us + toPos, from.timestamp_us + fromPos, count * sizeof(_u64));
+    }
+
+    RplidarScanSoA _nodes;
+    size_t  _mask;      // capacity - 1
+    _u64    _head;      // written by the producer only
+    _u64    _tail;      // written by the consumer only
+    _u64    _pushed;
+    _u64    _dropped;
+    rp::hal::SeqEvent _readyEvt;
+};
+
+// Resamples the nodes of every revolution onto bins evenly spaced angles while the
+// cache thread decodes them, node by node and without sorting: the bin of a node
+// follows from its angle with one multiplication. A completed revolution is handed
+// to the single consumer through three grids, so neither side ever waits for the
+// other: the producer fills its own grid and swaps it with the spare one, the
+// consumer swaps the spare one with the grid it reads from.
+class ScanGrid
+{
+public:
+    enum {
+        FRESH = 0x4, // set on the spare grid when it holds a revolution not read yet
+    };
+
+    ScanGrid()
+        : _bins(0), _policy(SCAN_GRID_NEAREST), _fill(0), _spare(1), _read(2)
+        , _started(false), _startUs(0), _endUs(0), _completed(0)
+    {
+    }
+
+    // bins 0 turns the grid off, only while the producer is stopped
+    void configure(size_t bins, _u32 policy)
+    {
+        _bins = bins;
+        _policy = policy;
+        for (int pos = 0; pos < 3; ++pos) {
+            _grids[pos].dist_mm_q2.assign(bins, 0);
+            _grids[pos].quality.assign(bins, 0);
+            _grids[pos].start_us = _grids[pos].end_us = 0;
+            _grids[pos].seq = 0;
+        }
+        _weight.assign(bins, 0);
+        _qualitySum.assign(bins, 0);
+        _fill = 0;
+        _spare = 1;
+        _read = 2;
+        _started = false;
+    }
+
+    size_t bins() const
+    {
+        return _bins;
+    }
+
+    // producer: the revolution in progress is thrown away when a scan is started
+    void restart()
+    {
+        _started = false;
+    }
+
+    // producer: bins the nodes of a decoded frame, a sync node completes the revolution
+    void accumulate(const RplidarScanSoA & nodes)
+    {
+        switch (_policy)
+        {
+        case SCAN_GRID_MIN_RANGE:
+            _accumulate<MinRange>(nodes);
+            break;
+        case SCAN_GRID_MEAN:
+            _accumulate<Mean>(nodes);
+            break;
+        default:
+            _accumulate<Nearest>(nodes);
+            break;
+        }
+    }
+
+    // consumer: waits for a revolution not read yet and copies it to grid
+    u_result grab(RplidarScanGrid & grid, _u32 timeout)
+    {
+        if (grid.bins < _bins) return RESULT_INSUFFICIENT_MEMORY;
+
+        for (;;) {
+            _u32 seen = _readyEvt.sequence();
+            if (__atomic_load_n(&_spare, __ATOMIC_ACQUIRE) & FRESH) break;
+
+            switch ((int)_readyEvt.wait(seen, timeout))
+            {
+            case rp::hal::SeqEvent::EVENT_OK:
+                break;
+            case rp::hal::SeqEvent::EVENT_TIMEOUT:
+                return RESULT_OPERATION_TIMEOUT;
+            default:
+                return RESULT_OPERATION_FAIL;
+            }
+        }
+
+        _read = __atomic_exchange_n(&_spare, _read, __ATOMIC_ACQ_REL) & ~(_u32)FRESH;
+        const Grid & from = _grids[_read];
+        memcpy(grid.dist_mm_q2, &from.dist_mm_q2[0], _bins * sizeof(_u32));
+        memcpy(grid.quality, &from.quality[0], _bins);
+        grid.bins = _bins;
+        grid.start_us = from.start_us;
+        grid.end_us = from.end_us;
+        grid.seq = from.seq;
+        return RESULT_OK;
+    }
+
+protected:
+    struct Grid
+    {
+        std::vector<_u32> dist_mm_q2;
+        std::vector<_u8>  quality;
+        _u64 start_us;
+        _u64 end_us;
+        _u64 seq;
+    };
+
+    // keeps the node closest to the centre of the bin, weight is its distance from it
+    struct Nearest
+    {
+        static void add(_u32 * dist, _u8 * quality, _u32 * weight, _u32 *, _u32 bin, _u32 offset, _u32 nodeDist, _u8 nodeQuality)
+        {
+            offset = offset < 0x8000 ? 0x8000 - offset : offset - 0x8000;
+            if (dist[bin] && weight[bin] <= offset) return;
+            dist[bin] = nodeDist;
+            quality[bin] = nodeQuality;
+            weight[bin] = offset;
+        }
+
+        static void complete(_u32 *, _u8 *, const _u32 *, const _u32 *, size_t) {}
+    };
+
+    // keeps the closest obstacle seen in the bin
+    struct MinRange
+    {
+        static void add(_u32 * dist, _u8 * quality, _u32 *, _u32 *, _u32 bin, _u32, _u32 nodeDist, _u8 nodeQuality)
+        {
+            if (dist[bin] && dist[bin] <= nodeDist) return;
+            dist[bin] = nodeDist;
+            quality[bin] = nodeQuality;
+        }
+
+        static void complete(_u32 *, _u8 *, const _u32 *, const _u32 *, size_t) {}
+    };
+
+    // sums up the nodes of the bin, weight counts them
+    struct Mean
+    {
+        static void add(_u32 * dist, _u8 *, _u32 * weight, _u32 * qualitySum, _u32 bin, _u32, _u32 nodeDist, _u8 nodeQuality)
+        {
+            dist[bin] += nodeDist;
+            qualitySum[bin] += nodeQuality;
+            ++weight[bin];
+        }
+
+        static void complete(_u32 * dist, _u8 * quality, const _u32 * weight, const _u32 * qualitySum, size_t bins)
+        {
+            for (size_t bin = 0; bin < bins; ++bin) {
+                if (!weight[bin]) continue;
+                dist[bin] = (dist[bin] + weight[bin] / 2) / weight[bin];
+                quality[bin] = (_u8)(qualitySum[bin] / weight[bin]);
+            }
+        }
+    };
+
+    template <class TPolicy>
+    void _accumulate(const RplidarScanSoA & nodes)
+    {
+        Grid * grid = &_grids[_fill];
+        for (size_t pos = 0; pos < nodes.count; ++pos) {
+            if (nodes.flag[pos] & RPLIDAR_RESP_MEASUREMENT_SYNCBIT) {
+                if (_started) {
+                    TPolicy::complete(&grid->dist_mm_q2[0], &grid->quality[0], &_weight[0], &_qualitySum[0], _bins);
+                    _publish();
+                    grid = &_grids[_fill];
+                }
+                memset(&grid->dist_mm_q2[0], 0, _bins * sizeof(_u32));
+                memset(&grid->quality[0], 0, _bins);
+                memset(&_weight[0], 0, _bins * sizeof(_u32));
+                memset(&_qualitySum[0], 0, _bins * sizeof(_u32));
+                _startUs = nodes.timestamp_us[pos];
+                _started = true;
+            }
+            if (!_started) continue;
+
+            _endUs = nodes.timestamp_us[pos];
+            if (!nodes.dist_mm_q2[pos]) continue;
+
+            // a full turn is 1 << 16 in angle_z_q14, so the bin is the upper half of angle * bins
+            _u32 scaled = (_u32)nodes.angle_z_q14[pos] * (_u32)_bins;
+            TPolicy::add(&grid->dist_mm_q2[0], &grid->quality[0], &_weight[0], &_qualitySum[0],
+                scaled >> 16, scaled & 0xFFFF, nodes.dist_mm_q2[pos], nodes.quality[pos]);
+        }
+    }
+
+    void _publish()
+    {
+        Grid & grid = _grids[_fill];
+        grid.start_us = _startUs;
+        grid.end_us = _endUs;
+        grid.seq = _completed++;
+        _fill = __atomic_exchange_n(&_spare, _fill | FRESH, __ATOMIC_ACQ_REL) & ~(_u32)FRESH;
+        _readyEvt.publish();
+    }
+
+    size_t  _bins;
+    _u32    _policy;
+    Grid    _grids[3];
+    std::vector<_u32> _weight;      // per bin, see the policies
+    std::vector<_u32> _qualitySum;
+    _u32    _fill;                  // producer owned
+    _u32    _spare;                 // index | FRESH, swapped by both sides
+    _u32    _read;                  // consumer owned
+    bool    _started;               // a sync node has been seen since the last restart()
+    _u64    _startUs;
+    _u64    _endUs;
+    _u64    _completed;
+    rp::hal::SeqEvent _readyEvt;
+};
+
+// Estimates the rotation speed from how fast the angle has moved on over the frames
+// decoded within the last WINDOW_US of host time, so it follows the motor several
+// times per revolution and doesn't depend on when anybody picks the scans up. Only
+// the cache thread updates it, any thread may read it: the estimate is published
+// under a sequence count which is odd while it is being written.
+class RotationEstimator
+{
+public:
+    enum {
+        SAMPLES   = 64,         // frames the window holds at most
+        WINDOW_US = 100000,     // time the estimate averages over
+    };
+
+    RotationEstimator()
+        : _head(0), _tail(0), _angle(0), _seq(0), _rpm(0), _timestampUs(0)
+    {
+    }
+
+    // producer: starts the window over, when a scan is started or frames went missing
+    void restart()
+    {
+        _tail = _head;
+    }
+
+    // producer: the last node of the frame tells the angle at the time it was measured
+    void update(const RplidarScanSoA & nodes)
+    {
+        if (!nodes.count) return;
+        const _u16 angle = nodes.angle_z_q14[nodes.count - 1];
+        const _u64 timestampUs = nodes.timestamp_us[nodes.count - 1];
+
+        if (_head != _tail) {
+            const Sample & last = _samples[(_head - 1) % SAMPLES];
+            // a full turn is 1 << 16, more than half a turn can't be told from going backwards
+            const _u16 progress = (_u16)(angle - (_u16)_angle);
+            if (progress >= 0x8000 || timestampUs <= last.timestampUs || timestampUs - last.timestampUs > WINDOW_US) {
+                restart();
+            } else {
+                _angle += progress;
+            }
+        }
+        if (_head == _tail) _angle = angle;
+
+        if (_head - _tail == SAMPLES) ++_tail;
+        Sample & sample = _samples[_head % SAMPLES];
+        sample.angle = _angle;
+        sample.timestampUs = timestampUs;
+        ++_head;
+
+        // the oldest sample stays the newest one at least WINDOW_US old
+        while (_head - _tail > 2 && timestampUs - _samples[(_tail + 1) % SAMPLES].timestampUs >= WINDOW_US) ++_tail;
+
+        const Sample & oldest = _samples[_tail % SAMPLES];
+        if (timestampUs - oldest.timestampUs < WINDOW_US / 4) return;
+
+        // least squares slope of the angle over the arrival times, the frames arrive with
+        // the jitter of the serial link and the two ends of the window alone take all of it
+        const _u64 count = _head - _tail;
+        double meanT = 0, meanA = 0;
+        for (_u64 pos = _tail; pos != _head; ++pos) {
+            meanT += (double)(_samples[pos % SAMPLES].timestampUs - oldest.timestampUs);
+            meanA += (double)(_samples[pos % SAMPLES].angle - oldest.angle);
+        }
+        meanT /= count;
+        meanA /= count;
+        double sumTT = 0, sumTA = 0;
+        for (_u64 pos = _tail; pos != _head; ++pos) {
+            const double t = (double)(_samples[pos % SAMPLES].timestampUs - oldest.timestampUs) - meanT;
+            sumTT += t * t;
+            sumTA += t * ((double)(_samples[pos % SAMPLES].angle - oldest.angle) - meanA);
+        }
+        _publish((float)(sumTA / sumTT * (60000000.0 / 65536.0)), timestampUs);
+    }
+
+    // any thread: the latest estimate, false before the first one
+    bool get(float & rpm, _u64 & timestampUs) const
+    {
+        for (;;) {
+            const _u32 seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+            __atomic_load(&_rpm, &rpm, __ATOMIC_RELAXED);
+            timestampUs = __atomic_load_n(&_timestampUs, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq) return timestampUs != 0;
+        }
+    }
+
+protected:
+    struct Sample
+    {
+        _u64 angle;             // unwrapped angle_z_q14
+        _u64 timestampUs;
+    };
+
+    void _publish(float rpm, _u64 timestampUs)
+    {
+        __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store(&_rpm, &rpm, __ATOMIC_RELAXED);
+        __atomic_store_n(&_timestampUs, timestampUs, __ATOMIC_RELAXED);
+        __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELEASE);
+    }
+
+    Sample  _samples[SAMPLES];  // producer owned
+    _u64    _head;
+    _u64    _tail;
+    _u64    _angle;             // unwrapped angle of the newest sample
+    _u32    _seq;
+    float   _rpm;
+    _u64    _timestampUs;
+};
+
+}}}
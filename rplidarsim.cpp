@@ -0,0 +1,677 @@
+/**
+ * Copyright (C) 2021 by Bernd Porr
+ *
+ * RPLIDAR device simulator on a pseudo terminal.
+ *
+ * Answers the commands of rplidar_cmd.h and streams synthetic scans of
+ * a rectangular room in standard, express, dense (boost), ultra capsule
+ * or HQ format so that the driver and A1Lidar can be load tested
+ * without hardware. Point A1Lidar::start() at the printed pty path.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <errno.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "rplidarsdk/rplidar.h"
+
+// scan modes as reported via RPLIDAR_CMD_GET_LIDAR_CONF
+enum SimMode {
+	MODE_STANDARD = 0,
+	MODE_EXPRESS = 1,
+	MODE_BOOST = 2,
+	MODE_ULTRA = 3,
+	MODE_HQ = 4,
+	NUM_MODES = 5
+};
+
+static const char* modeNames[NUM_MODES] = {
+	"Standard", "Express", "Boost", "Ultra", "HQ"
+};
+
+static const _u8 modeAnsTypes[NUM_MODES] = {
+	RPLIDAR_ANS_TYPE_MEASUREMENT,
+	RPLIDAR_ANS_TYPE_MEASUREMENT_CAPSULED,
+	RPLIDAR_ANS_TYPE_MEASUREMENT_DENSE_CAPSULED,
+	RPLIDAR_ANS_TYPE_MEASUREMENT_CAPSULED_ULTRA,
+	RPLIDAR_ANS_TYPE_MEASUREMENT_HQ
+};
+
+static const unsigned modeFrameSizes[NUM_MODES] = {
+	sizeof(rplidar_response_measurement_node_t),
+	sizeof(rplidar_response_capsule_measurement_nodes_t),
+	sizeof(rplidar_response_dense_capsule_measurement_nodes_t),
+	sizeof(rplidar_response_ultra_capsule_measurement_nodes_t),
+	sizeof(rplidar_response_hq_capsule_measurement_nodes_t)
+};
+
+// samples per transmitted frame
+static const unsigned modeFrameSamples[NUM_MODES] = {
+	1, 32, 40, 96, 16
+};
+
+struct SimConfig {
+	int typicalMode = MODE_EXPRESS;
+	float rpm = 300;
+	float sampleRate = 4000;
+	long bytesPerSec = 11520; // 115200 baud with 8N1
+	float dropoutRate = 0.02f;
+	const char* link = nullptr;
+};
+
+static SimConfig cfg;
+static int masterFd = -1;
+static std::atomic<bool> quit(false);
+static std::atomic<int> streamMode(-1);
+static std::atomic<unsigned> streamGeneration(0);
+static std::mutex writeMtx;
+
+static void sig_handler(int) {
+	quit = true;
+}
+
+static _u64 nowNs() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (_u64)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void sleepUntilNs(_u64 t) {
+	struct timespec ts;
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void writeAll(const void* data, size_t len) {
+	const _u8* p = (const _u8*)data;
+	while (len > 0) {
+		ssize_t n = write(masterFd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EIO) {
+				// nobody is reading the slave at the moment
+				usleep(1000);
+				if (quit) return;
+				continue;
+			}
+			return;
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+static void sendAnswer(_u8 type, const void* payload, _u32 size, bool loop = false) {
+	rplidar_ans_header_t h;
+	h.syncByte1 = RPLIDAR_ANS_SYNC_BYTE1;
+	h.syncByte2 = RPLIDAR_ANS_SYNC_BYTE2;
+	h.size_q30_subtype = size | ((loop ? RPLIDAR_ANS_PKTFLAG_LOOP : 0) << RPLIDAR_ANS_HEADER_SUBTYPE_SHIFT);
+	h.type = type;
+	std::lock_guard<std::mutex> lock(writeMtx);
+	writeAll(&h, sizeof(h));
+	if (payload && !loop) writeAll(payload, size);
+}
+
+// same CRC as the driver uses for the HQ capsules including its zero padding
+static _u32 crcTable[256];
+
+static void crcInit() {
+	for (_u32 i = 0; i < 256; i++) {
+		_u32 c = i;
+		for (int j = 0; j < 8; j++) c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+		crcTable[i] = c;
+	}
+}
+
+static _u32 crc32(const _u8* p, _u32 len) {
+	_u32 crc = 0xFFFFFFFF;
+	for (_u32 i = 0; i < len; i++) crc = (crc >> 8) ^ crcTable[(crc ^ p[i]) & 0xFF];
+	for (_u32 i = 0; i < ((4 - len) & 0x3); i++) crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+	return crc ^ 0xFFFFFFFF;
+}
+
+// inverse of the variable bit scale decoder of the driver
+static _u32 vbsEncode(_u32 dist, _u32& scaleLevel) {
+	if (dist >= (1 << RPLIDAR_VARBITSCALE_X16_SRC_BIT)) {
+		scaleLevel = 4;
+		_u32 s = RPLIDAR_VARBITSCALE_X16_DEST_VAL + ((dist - (1 << RPLIDAR_VARBITSCALE_X16_SRC_BIT)) >> 4);
+		return s > 0xFFF ? 0xFFF : s;
+	}
+	if (dist >= (1 << RPLIDAR_VARBITSCALE_X8_SRC_BIT)) {
+		scaleLevel = 3;
+		return RPLIDAR_VARBITSCALE_X8_DEST_VAL + ((dist - (1 << RPLIDAR_VARBITSCALE_X8_SRC_BIT)) >> 3);
+	}
+	if (dist >= (1 << RPLIDAR_VARBITSCALE_X4_SRC_BIT)) {
+		scaleLevel = 2;
+		return RPLIDAR_VARBITSCALE_X4_DEST_VAL + ((dist - (1 << RPLIDAR_VARBITSCALE_X4_SRC_BIT)) >> 2);
+	}
+	if (dist >= (1 << RPLIDAR_VARBITSCALE_X2_SRC_BIT)) {
+		scaleLevel = 1;
+		return RPLIDAR_VARBITSCALE_X2_DEST_VAL + ((dist - (1 << RPLIDAR_VARBITSCALE_X2_SRC_BIT)) >> 1);
+	}
+	scaleLevel = 0;
+	return dist;
+}
+
+static _u32 vbsDecode(_u32 scaled, _u32& scaleLevel) {
+	static const _u32 base[] = {RPLIDAR_VARBITSCALE_X16_DEST_VAL, RPLIDAR_VARBITSCALE_X8_DEST_VAL,
+				    RPLIDAR_VARBITSCALE_X4_DEST_VAL, RPLIDAR_VARBITSCALE_X2_DEST_VAL, 0};
+	static const _u32 lvl[] = {4, 3, 2, 1, 0};
+	static const _u32 target[] = {1 << RPLIDAR_VARBITSCALE_X16_SRC_BIT, 1 << RPLIDAR_VARBITSCALE_X8_SRC_BIT,
+				      1 << RPLIDAR_VARBITSCALE_X4_SRC_BIT, 1 << RPLIDAR_VARBITSCALE_X2_SRC_BIT, 0};
+	for (int i = 0; i < 5; i++) {
+		if (scaled >= base[i]) {
+			scaleLevel = lvl[i];
+			return target[i] + ((scaled - base[i]) << lvl[i]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Synthetic sample generator: a 6m x 4m room with the lidar off centre
+ * and a few dropouts so that invalid points are exercised as well.
+ **/
+struct Sample {
+	float angleDeg;
+	_u32 distMm;
+	bool sync;
+};
+
+class SampleSource {
+public:
+	void reset() {
+		n = 0;
+		angle = 0;
+		rng = 12345;
+	}
+
+	Sample next() {
+		Sample s;
+		s.angleDeg = angle;
+		s.sync = false;
+		const float a = angle * (float)M_PI / 180.0f;
+		const float c = cosf(a), si = sinf(a);
+		float r = 1e9f;
+		if (c > 1e-6f) r = fminf(r, 3.5f / c);
+		if (c < -1e-6f) r = fminf(r, -2.5f / c);
+		if (si > 1e-6f) r = fminf(r, 1.5f / si);
+		if (si < -1e-6f) r = fminf(r, -2.5f / si);
+		s.distMm = (_u32)(r * 1000.0f);
+		rng = rng * 1103515245 + 12345;
+		if (((rng >> 16) & 0x7fff) < cfg.dropoutRate * 32768) s.distMm = 0;
+		const float inc = 360.0f * cfg.rpm / 60.0f / cfg.sampleRate;
+		angle += inc;
+		if (angle >= 360.0f) {
+			angle -= 360.0f;
+		}
+		// sync marks the first sample of a new revolution
+		if (n > 0 && s.angleDeg < prevAngle) s.sync = true;
+		prevAngle = s.angleDeg;
+		n++;
+		return s;
+	}
+
+private:
+	unsigned long n = 0;
+	float angle = 0;
+	float prevAngle = 0;
+	_u32 rng = 12345;
+};
+
+static _u16 angleQ6(float deg) {
+	return (_u16)(deg * 64.0f) & 0x7FFF;
+}
+
+static void capsuleChecksum(_u8* frame, size_t size) {
+	_u8 cs = 0;
+	for (size_t i = 2; i < size; i++) cs ^= frame[i];
+	frame[0] = (RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_1 << 4) | (cs & 0xF);
+	frame[1] = (RPLIDAR_RESP_MEASUREMENT_EXP_SYNC_2 << 4) | (cs >> 4);
+}
+
+static void encodeStandard(const Sample& s, std::vector<_u8>& out) {
+	rplidar_response_measurement_node_t node;
+	const _u8 quality = s.distMm ? 47 : 0;
+	node.sync_quality = (quality << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) | (s.sync ? 1 : 2);
+	node.angle_q6_checkbit = (angleQ6(s.angleDeg) << RPLIDAR_RESP_MEASUREMENT_ANGLE_SHIFT) | RPLIDAR_RESP_MEASUREMENT_CHECKBIT;
+	node.distance_q2 = s.distMm > 16383 ? 0 : (_u16)(s.distMm << 2);
+	const _u8* p = (const _u8*)&node;
+	out.insert(out.end(), p, p + sizeof(node));
+}
+
+static void encodeExpress(const Sample* s, bool first, std::vector<_u8>& out) {
+	rplidar_response_capsule_measurement_nodes_t c;
+	memset(&c, 0, sizeof(c));
+	c.start_angle_sync_q6 = angleQ6(s[0].angleDeg) | (first ? RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT : 0);
+	for (int i = 0; i < 16; i++) {
+		const _u32 d1 = s[i * 2].distMm > 16383 ? 0 : s[i * 2].distMm;
+		const _u32 d2 = s[i * 2 + 1].distMm > 16383 ? 0 : s[i * 2 + 1].distMm;
+		c.cabins[i].distance_angle_1 = (_u16)(d1 << 2);
+		c.cabins[i].distance_angle_2 = (_u16)(d2 << 2);
+		c.cabins[i].offset_angles_q3 = 0;
+	}
+	capsuleChecksum((_u8*)&c, sizeof(c));
+	const _u8* p = (const _u8*)&c;
+	out.insert(out.end(), p, p + sizeof(c));
+}
+
+static void encodeDense(const Sample* s, bool first, std::vector<_u8>& out) {
+	rplidar_response_dense_capsule_measurement_nodes_t c;
+	memset(&c, 0, sizeof(c));
+	c.start_angle_sync_q6 = angleQ6(s[0].angleDeg) | (first ? RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT : 0);
+	for (int i = 0; i < 40; i++) {
+		c.cabins[i].distance = (_u16)(s[i].distMm > 0xFFFF ? 0 : s[i].distMm);
+	}
+	capsuleChecksum((_u8*)&c, sizeof(c));
+	const _u8* p = (const _u8*)&c;
+	out.insert(out.end(), p, p + sizeof(c));
+}
+
+static _u32 encodePredict(_u32 dist, _u32 base, _u32 scaleLevel) {
+	if ((!dist) || (!base)) return 0x1FF; // marks an invalid sample
+	int predict = ((int)dist - (int)base) >> scaleLevel;
+	if (predict > 0x1FE) predict = 0x1FE;
+	if (predict < -511) predict = -511;
+	return (_u32)predict & 0x3FF;
+}
+
+// s holds 96 samples of this capsule followed by the first sample of the next one
+static void encodeUltra(const Sample* s, bool first, std::vector<_u8>& out) {
+	rplidar_response_ultra_capsule_measurement_nodes_t c;
+	memset(&c, 0, sizeof(c));
+	c.start_angle_sync_q6 = angleQ6(s[0].angleDeg) | (first ? RPLIDAR_RESP_MEASUREMENT_EXP_SYNCBIT : 0);
+	for (int i = 0; i < 32; i++) {
+		_u32 lvl1, lvl2;
+		const _u32 major = vbsEncode(s[i * 3].distMm, lvl1);
+		const _u32 major2 = vbsEncode(s[i * 3 + 3].distMm, lvl2);
+		_u32 base1 = vbsDecode(major, lvl1);
+		const _u32 base2 = vbsDecode(major2, lvl2);
+		if ((!base1) && base2) {
+			base1 = base2;
+			lvl1 = lvl2;
+		}
+		const _u32 p1 = encodePredict(s[i * 3 + 1].distMm, base1, lvl1);
+		const _u32 p2 = encodePredict(s[i * 3 + 2].distMm, base2, lvl2);
+		c.ultra_cabins[i].combined_x3 = major | (p1 << 12) | (p2 << 22);
+	}
+	capsuleChecksum((_u8*)&c, sizeof(c));
+	const _u8* p = (const _u8*)&c;
+	out.insert(out.end(), p, p + sizeof(c));
+}
+
+static void encodeHq(const Sample* s, _u64 timestamp, std::vector<_u8>& out) {
+	rplidar_response_hq_capsule_measurement_nodes_t c;
+	memset(&c, 0, sizeof(c));
+	c.sync_byte = RPLIDAR_RESP_MEASUREMENT_HQ_SYNC;
+	c.time_stamp = timestamp;
+	for (int i = 0; i < 16; i++) {
+		c.node_hq[i].angle_z_q14 = (_u16)(s[i].angleDeg * 16384.0f / 90.0f);
+		c.node_hq[i].dist_mm_q2 = s[i].distMm << 2;
+		c.node_hq[i].quality = s[i].distMm ? (47 << RPLIDAR_RESP_MEASUREMENT_QUALITY_SHIFT) : 0;
+		c.node_hq[i].flag = s[i].sync ? RPLIDAR_RESP_HQ_FLAG_SYNCBIT : 0;
+	}
+	c.crc32 = crc32((const _u8*)&c, sizeof(c) - 4);
+	const _u8* p = (const _u8*)&c;
+	out.insert(out.end(), p, p + sizeof(c));
+}
+
+/**
+ * Streams the frames of the current scan mode paced by the sample
+ * rate and, if set, by the emulated serial bandwidth.
+ **/
+static void streamer() {
+	SampleSource source;
+	std::vector<Sample> samples;
+	std::vector<_u8> frame;
+	unsigned generation = 0;
+	int mode = -1;
+	bool first = true;
+	_u64 sampleTime = 0;
+	_u64 byteTime = 0;
+	unsigned long frames = 0;
+	unsigned long long bytes = 0;
+	_u64 statTime = nowNs();
+
+	while (!quit) {
+		if (streamGeneration != generation || streamMode != mode) {
+			generation = streamGeneration;
+			mode = streamMode;
+			source.reset();
+			samples.clear();
+			first = true;
+			sampleTime = byteTime = nowNs();
+		}
+		if (mode < 0) {
+			usleep(1000);
+			continue;
+		}
+		const unsigned n = modeFrameSamples[mode];
+		// the ultra capsule needs the first sample of the next capsule
+		const unsigned lookahead = (mode == MODE_ULTRA) ? 1 : 0;
+		while (samples.size() < n + lookahead) samples.push_back(source.next());
+		frame.clear();
+		switch (mode) {
+		case MODE_STANDARD:
+			encodeStandard(samples[0], frame);
+			break;
+		case MODE_EXPRESS:
+			encodeExpress(samples.data(), first, frame);
+			break;
+		case MODE_BOOST:
+			encodeDense(samples.data(), first, frame);
+			break;
+		case MODE_ULTRA:
+			encodeUltra(samples.data(), first, frame);
+			break;
+		case MODE_HQ:
+			encodeHq(samples.data(), sampleTime / 1000, frame);
+			break;
+		}
+		samples.erase(samples.begin(), samples.begin() + n);
+		first = false;
+
+		// the frame leaves the device once all of its samples have been measured
+		sampleTime += (_u64)(n * 1e9 / cfg.sampleRate);
+		_u64 t = sampleTime;
+		if (cfg.bytesPerSec > 0) {
+			byteTime += (_u64)(frame.size() * 1e9 / cfg.bytesPerSec);
+			if (byteTime > t) t = byteTime;
+		}
+		sleepUntilNs(t);
+		if ((streamGeneration != generation) || (streamMode != mode)) continue;
+		{
+			std::lock_guard<std::mutex> lock(writeMtx);
+			writeAll(frame.data(), frame.size());
+		}
+		frames++;
+		bytes += frame.size();
+		const _u64 now = nowNs();
+		if (now - statTime > 5000000000ULL) {
+			const double dt = (now - statTime) / 1e9;
+			fprintf(stderr, "%s: %.0f frames/s, %.0f bytes/s, %.0f samples/s\n",
+				modeNames[mode], frames / dt, bytes / dt, frames * n / dt);
+			frames = 0;
+			bytes = 0;
+			statTime = now;
+		}
+	}
+}
+
+static void answerLidarConf(const _u8* payload, _u8 size) {
+	if (size < sizeof(_u32)) return;
+	_u32 type;
+	memcpy(&type, payload, sizeof(type));
+	_u16 modeId = 0;
+	if (size >= sizeof(_u32) + sizeof(_u16)) memcpy(&modeId, payload + sizeof(_u32), sizeof(modeId));
+	if (modeId >= NUM_MODES) modeId = 0;
+
+	std::vector<_u8> ans((const _u8*)&type, (const _u8*)&type + sizeof(type));
+	switch (type) {
+	case RPLIDAR_CONF_SCAN_MODE_COUNT: {
+		_u16 count = NUM_MODES;
+		ans.insert(ans.end(), (_u8*)&count, (_u8*)&count + sizeof(count));
+		break;
+	}
+	case RPLIDAR_CONF_SCAN_MODE_TYPICAL: {
+		_u16 typical = (_u16)cfg.typicalMode;
+		ans.insert(ans.end(), (_u8*)&typical, (_u8*)&typical + sizeof(typical));
+		break;
+	}
+	case RPLIDAR_CONF_SCAN_MODE_US_PER_SAMPLE: {
+		_u32 us = (_u32)(1e6f / cfg.sampleRate * 256.0f);
+		ans.insert(ans.end(), (_u8*)&us, (_u8*)&us + sizeof(us));
+		break;
+	}
+	case RPLIDAR_CONF_SCAN_MODE_MAX_DISTANCE: {
+		_u32 d = 12 << 8;
+		ans.insert(ans.end(), (_u8*)&d, (_u8*)&d + sizeof(d));
+		break;
+	}
+	case RPLIDAR_CONF_SCAN_MODE_ANS_TYPE:
+		ans.push_back(modeAnsTypes[modeId]);
+		break;
+	case RPLIDAR_CONF_SCAN_MODE_NAME:
+		ans.insert(ans.end(), modeNames[modeId], modeNames[modeId] + strlen(modeNames[modeId]) + 1);
+		break;
+	default:
+		return;
+	}
+	sendAnswer(RPLIDAR_ANS_TYPE_GET_LIDAR_CONF, ans.data(), ans.size());
+}
+
+static void startStream(int mode) {
+	sendAnswer(modeAnsTypes[mode], nullptr, modeFrameSizes[mode], true);
+	streamMode = mode;
+	streamGeneration++;
+	fprintf(stderr, "Streaming %s frames.\n", modeNames[mode]);
+}
+
+static void stopStream() {
+	if (streamMode >= 0) fprintf(stderr, "Stopped.\n");
+	streamMode = -1;
+	streamGeneration++;
+}
+
+static void handleCommand(_u8 cmd, const _u8* payload, _u8 size) {
+	switch (cmd) {
+	case RPLIDAR_CMD_STOP:
+	case RPLIDAR_CMD_RESET:
+		stopStream();
+		break;
+	case RPLIDAR_CMD_GET_DEVICE_INFO: {
+		stopStream();
+		rplidar_response_device_info_t info;
+		memset(&info, 0, sizeof(info));
+		info.model = 0x18; // A1M8
+		info.firmware_version = (1 << 8) | 29;
+		info.hardware_version = 7;
+		for (int i = 0; i < 16; i++) info.serialnum[i] = (_u8)(0x51 + i);
+		sendAnswer(RPLIDAR_ANS_TYPE_DEVINFO, &info, sizeof(info));
+		break;
+	}
+	case RPLIDAR_CMD_GET_DEVICE_HEALTH: {
+		stopStream();
+		rplidar_response_device_health_t health;
+		memset(&health, 0, sizeof(health));
+		health.status = RPLIDAR_STATUS_OK;
+		sendAnswer(RPLIDAR_ANS_TYPE_DEVHEALTH, &health, sizeof(health));
+		break;
+	}
+	case RPLIDAR_CMD_GET_SAMPLERATE: {
+		rplidar_response_sample_rate_t rate;
+		rate.std_sample_duration_us = (_u16)(1e6f / cfg.sampleRate);
+		rate.express_sample_duration_us = (_u16)(1e6f / cfg.sampleRate);
+		sendAnswer(RPLIDAR_ANS_TYPE_SAMPLE_RATE, &rate, sizeof(rate));
+		break;
+	}
+	case RPLIDAR_CMD_GET_ACC_BOARD_FLAG: {
+		rplidar_response_acc_board_flag_t flag;
+		flag.support_flag = 0;
+		sendAnswer(RPLIDAR_ANS_TYPE_ACC_BOARD_FLAG, &flag, sizeof(flag));
+		break;
+	}
+	case RPLIDAR_CMD_GET_LIDAR_CONF:
+		answerLidarConf(payload, size);
+		break;
+	case RPLIDAR_CMD_SCAN:
+	case RPLIDAR_CMD_FORCE_SCAN:
+		startStream(MODE_STANDARD);
+		break;
+	case RPLIDAR_CMD_EXPRESS_SCAN: {
+		// the legacy express mode is requested with working_mode 0
+		int mode = MODE_EXPRESS;
+		if ((size > 0) && (payload[0] > 0) && (payload[0] < NUM_MODES)) mode = payload[0];
+		startStream(mode);
+		break;
+	}
+	default:
+		// motor control and the like need no answer
+		break;
+	}
+}
+
+/**
+ * Reassembles the command packets sent by the driver.
+ **/
+class CommandParser {
+public:
+	void feed(_u8 b) {
+		buf.push_back(b);
+		while (!buf.empty()) {
+			if (buf[0] != RPLIDAR_CMD_SYNC_BYTE) {
+				buf.erase(buf.begin());
+				continue;
+			}
+			if (buf.size() < 2) return;
+			const _u8 cmd = buf[1];
+			if (!(cmd & RPLIDAR_CMDFLAG_HAS_PAYLOAD)) {
+				handleCommand(cmd, nullptr, 0);
+				buf.erase(buf.begin(), buf.begin() + 2);
+				continue;
+			}
+			if (buf.size() < 3) return;
+			const _u8 size = buf[2];
+			if (buf.size() < (size_t)size + 4) return;
+			_u8 checksum = 0;
+			for (size_t i = 0; i < (size_t)size + 3; i++) checksum ^= buf[i];
+			if (checksum == buf[size + 3]) {
+				handleCommand(cmd, &buf[3], size);
+			} else {
+				fprintf(stderr, "Command 0x%02x with bad checksum.\n", cmd);
+			}
+			buf.erase(buf.begin(), buf.begin() + size + 4);
+		}
+	}
+
+private:
+	std::vector<_u8> buf;
+};
+
+static int modeByName(const char* name) {
+	for (int i = 0; i < NUM_MODES; i++) {
+		if (strcasecmp(name, modeNames[i]) == 0) return i;
+	}
+	if (strcasecmp(name, "dense") == 0) return MODE_BOOST;
+	return atoi(name);
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "Usage: %s [-m mode] [-r rpm] [-s samplerate] [-b baudrate] [-d dropout] [-l link]\n"
+		" -m  typical scan mode: standard, express, boost (dense), ultra or hq (default express)\n"
+		" -r  rotation speed in RPM (default 300)\n"
+		" -s  samples per second (default 4000)\n"
+		" -b  emulated baudrate, 0 for unlimited (default 115200)\n"
+		" -d  fraction of invalid samples (default 0.02)\n"
+		" -l  creates a symlink to the pty, e.g. /tmp/ttyLIDAR\n",
+		prog);
+}
+
+int main(int argc, char **argv) {
+	int c;
+	while ((c = getopt(argc, argv, "m:r:s:b:d:l:h")) != -1) {
+		switch (c) {
+		case 'm':
+			cfg.typicalMode = modeByName(optarg);
+			if ((cfg.typicalMode < 0) || (cfg.typicalMode >= NUM_MODES)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			cfg.rpm = atof(optarg);
+			break;
+		case 's':
+			cfg.sampleRate = atof(optarg);
+			break;
+		case 'b':
+			cfg.bytesPerSec = atol(optarg) / 10;
+			break;
+		case 'd':
+			cfg.dropoutRate = atof(optarg);
+			break;
+		case 'l':
+			cfg.link = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((cfg.rpm <= 0) || (cfg.sampleRate <= 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	crcInit();
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((masterFd < 0) || grantpt(masterFd) || unlockpt(masterFd)) {
+		perror("Could not create the pty");
+		return 1;
+	}
+	const char* slaveName = ptsname(masterFd);
+
+	// keep the slave open so that the master does not see a hangup between clients
+	int slaveFd = open(slaveName, O_RDWR | O_NOCTTY);
+	struct termios tio;
+	tcgetattr(slaveFd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slaveFd, TCSANOW, &tio);
+
+	if (cfg.link) {
+		unlink(cfg.link);
+		if (symlink(slaveName, cfg.link)) perror("symlink");
+	}
+
+	const double bytesNeeded = cfg.sampleRate / modeFrameSamples[cfg.typicalMode] * modeFrameSizes[cfg.typicalMode];
+	fprintf(stderr, "RPLIDAR simulator on %s: %s mode, %.0f RPM, %.0f samples/s, %.0f bytes/s",
+		cfg.link ? cfg.link : slaveName, modeNames[cfg.typicalMode], cfg.rpm, cfg.sampleRate, bytesNeeded);
+	if (cfg.bytesPerSec > 0) {
+		fprintf(stderr, " of %ld bytes/s available\n", cfg.bytesPerSec);
+		if (bytesNeeded > cfg.bytesPerSec) {
+			fprintf(stderr, "Warning: the sample rate exceeds the baudrate. The scan will slow down.\n");
+		}
+	} else {
+		fprintf(stderr, " with unlimited baudrate\n");
+	}
+	printf("%s\n", slaveName);
+	fflush(stdout);
+
+	std::thread stream(streamer);
+	CommandParser parser;
+	while (!quit) {
+		struct pollfd pfd;
+		pfd.fd = masterFd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) <= 0) continue;
+		_u8 buf[256];
+		ssize_t n = read(masterFd, buf, sizeof(buf));
+		if (n <= 0) {
+			usleep(10000);
+			continue;
+		}
+		for (ssize_t i = 0; i < n; i++) parser.feed(buf[i]);
+	}
+	stream.join();
+	if (cfg.link) unlink(cfg.link);
+	close(slaveFd);
+	close(masterFd);
+	fprintf(stderr, "\nSimulator stopped.\n");
+	return 0;
+}
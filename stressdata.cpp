@@ -0,0 +1,122 @@
+#include "a1lidarrpi.h"
+#include <map>
+
+// Reads getCurrentData(seq) as fast as it can while the acquisition is
+// running, for example against rplidarsim, and checks that every scan
+// it gets is the one a subscriber was given under the same seq, that
+// seq never goes backwards and that a scan which is held on to isn't
+// written to while the acquisition carries on.
+
+static uint64_t hashReading(uint64_t h, float v) {
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return (h ^ bits) * 1099511628211ULL;
+}
+
+static uint64_t hashData(const A1LidarData (&data)[A1Lidar::nDistance]) {
+	uint64_t h = 1469598103934665603ULL;
+	for(unsigned i = 0; i < A1Lidar::nDistance; i++) {
+		if (!data[i].valid) continue;
+		h = hashReading(h, data[i].x);
+		h = hashReading(h, data[i].y);
+		h = hashReading(h, data[i].r);
+		h = hashReading(h, data[i].phi);
+		h = hashReading(h, data[i].signal_strength);
+	}
+	return h;
+}
+
+static uint64_t hashView(const A1LidarScanView &view) {
+	uint64_t h = 1469598103934665603ULL;
+	for(unsigned i = 0; i < view.count; i++) {
+		h = hashReading(h, view.x[i]);
+		h = hashReading(h, view.y[i]);
+		h = hashReading(h, view.r[i]);
+		h = hashReading(h, view.phi[i]);
+		h = hashReading(h, view.signal_strength[i]);
+	}
+	return h;
+}
+
+class Subscriber : public A1Lidar::SubscriberInterface {
+public:
+	void newScanAvail(const A1LidarScanView &view) {
+		const uint64_t h = hashView(view);
+		std::lock_guard<std::mutex> lock(mtx);
+		hashes[view.seq] = h;
+		lastSeq = view.seq;
+	}
+
+	bool find(uint64_t seq, uint64_t &h) {
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = hashes.find(seq);
+		if (it == hashes.end()) return false;
+		h = it->second;
+		return true;
+	}
+
+	uint64_t latest() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return lastSeq;
+	}
+
+private:
+	std::mutex mtx;
+	std::map<uint64_t, uint64_t> hashes;
+	uint64_t lastSeq = 0;
+};
+
+int main(int argc, char **argv) {
+	const char *port = argc > 1 ? argv[1] : "/dev/serial0";
+	const int seconds = argc > 2 ? atoi(argv[2]) : 10;
+	if (argc < 2) fprintf(stderr,"Usage: %s [serial port] [seconds]\n", argv[0]);
+	A1Lidar lidar;
+	Subscriber subscriber;
+	lidar.subscribe(&subscriber, 1,
+			A1LidarScanView::X | A1LidarScanView::Y | A1LidarScanView::R |
+			A1LidarScanView::PHI | A1LidarScanView::SIGNAL_STRENGTH);
+	lidar.start(port);
+
+	uint64_t reads = 0, scans = 0, lastSeq = 0;
+	unsigned backwards = 0, unknown = 0, mismatched = 0, overwritten = 0, stalled = 0, held = 0;
+	const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	while (std::chrono::steady_clock::now() < end) {
+		uint64_t seq;
+		const A1LidarData (&data)[A1Lidar::nDistance] = lidar.getCurrentData(seq);
+		reads++;
+		if (seq < lastSeq) backwards++;
+		if ( (0 == seq) || (seq == lastSeq) ) continue;
+		lastSeq = seq;
+		scans++;
+		const uint64_t h = hashData(data);
+		uint64_t published;
+		if (!subscriber.find(seq, published)) {
+			unknown++;
+			continue;
+		}
+		if (h != published) mismatched++;
+		// every 4th scan is held until two newer ones have come in,
+		// the acquisition has to carry on without touching it
+		if (0 == scans % 4) {
+			const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while ( (subscriber.latest() < seq + 2) &&
+				(std::chrono::steady_clock::now() < timeout) ) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			if (subscriber.latest() < seq + 2) stalled++;
+			if (hashData(data) != h) overwritten++;
+			held++;
+		}
+	}
+	lidar.stop();
+
+	printf("%llu reads, %llu scans, %u of them held\n",
+	       (unsigned long long)reads, (unsigned long long)scans, held);
+	printf("seq backwards: %u, seq not published: %u, data not matching its seq: %u\n",
+	       backwards, unknown, mismatched);
+	printf("overwritten while held: %u, acquisition stalled while held: %u\n",
+	       overwritten, stalled);
+	const bool failed = (0 == scans) || backwards || unknown || mismatched || overwritten || stalled;
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+	return failed ? 1 : 0;
+}